@@ -0,0 +1,71 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+#define CHUNK_SIZE 32768u
+
+// Stand-in for C11's max_align_t.
+union align { long long ll; long double ld; void *p; };
+#define ALIGN_TO (sizeof(union align))
+
+// The arena is a list of chunks which are never given back to malloc.
+// Allocation bumps an offset into the current chunk, moving on to the
+// next chunk (or a new one) when it's full.  A search's allocations all
+// go at once, when it ends, so a reset frees everything.
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    union align data[];
+};
+
+static struct arena_chunk *new_chunk(size_t min_size) {
+    size_t size = CHUNK_SIZE;
+    while (size < min_size)
+        size *= 2;
+    struct arena_chunk *ch = malloc(sizeof(*ch) + size);
+    if (ch == NULL)
+        errexit('m', "Out of memory allocating a %zu byte arena chunk.", size);
+    ch->next = NULL;
+    ch->size = size;
+    return ch;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + ALIGN_TO - 1) & ~(ALIGN_TO - 1);
+
+    if (a->cur == NULL) {
+        if (a->head == NULL)
+            a->head = new_chunk(size);
+        a->cur = a->head;
+        a->used = 0;
+    }
+    while (a->used + size > a->cur->size) {
+        // Skip to the next chunk, making one if we're at the end of
+        // the list or the next one is too small.
+        if (a->cur->next == NULL || a->cur->next->size < size) {
+            struct arena_chunk *ch = new_chunk(size);
+            ch->next = a->cur->next;
+            a->cur->next = ch;
+        }
+        a->in_use += a->cur->size - a->used;   // Wasted tail of the chunk.
+        a->cur = a->cur->next;
+        a->used = 0;
+    }
+
+    void *rv = (char *) a->cur->data + a->used;
+    a->used += size;
+    a->in_use += size;
+    if (a->in_use > a->hiwater)
+        a->hiwater = a->in_use;
+    return rv;
+}
+
+void arena_reset(struct arena *a) {
+    a->cur = NULL;
+    a->used = 0;
+    a->in_use = 0;
+}
@@ -0,0 +1,343 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// A weighted A* search over (row, col, alt, bearing, tick, cleared_exit),
+// as an alternative to plot_course()'s greedy search with backtracking.
+// Moves are checked with the same check_move() that calc_next_move()
+// uses, and the cost of a route is its length in ticks.  So with a weight
+// of 1 this finds the quickest route around the committed courses, and
+// heavier weights trade route length for fewer expansions.
+//
+// Most routes take a few dozen expansions, so the seen set and the heap
+// start small and double as they fill, rather than being sized (and
+// cleared) for the longest search every time.
+
+#define MAX_EXPANSIONS 10000
+#define MAX_CHILDREN 15
+#define MAX_NODES (MAX_EXPANSIONS * MAX_CHILDREN + 1)
+#define HASH_BITS 20        // The seen set's most; twice MAX_NODES.
+#define MIN_HASH_BITS 10
+#define MIN_HEAP 256
+
+struct node {
+    const struct node *parent;
+    int tick, g, f;
+    unsigned int seq;
+    signed char row, col, alt, bearing;
+    bool cleared_exit;
+};
+
+struct search {
+    const struct plane *p;
+    struct xyz target;
+    int tick0;
+    const struct node **heap;
+    int n_heap, heap_cap;
+    unsigned int *seen;
+    unsigned int seen_bits, n_seen;
+    unsigned int n_nodes;
+    const struct node *newest;  // The node last added.
+};
+
+// The record most expansions for a plan.
+static int rec_expansions;
+
+static inline int imax(int a, int b) {
+    return a > b ? a : b;
+}
+
+// A lower bound on the ticks to get to the target:  Each move changes
+// row, col, and altitude by at most one, or, better, the moves the
+// cost-to-go table says are left, and props only move every other tick.
+// Nor can it arrive before its arrival slot opens.  -1 if the target can't
+// be reached from here at 'tick'.
+static int heuristic(const struct search *s, int tick, int row, int col,
+                     int alt, int bearing, bool cleared_exit) {
+    int moves = imax(abs(row - s->target.row),
+                     imax(abs(col - s->target.col), abs(alt - s->target.alt)));
+    int ctg = cost_to_go(s->p, row, col, alt, bearing, cleared_exit);
+    if (ctg == CTG_INF)
+        return -1;
+    moves = imax(moves, ctg);
+    int ticks = s->p->isjet || moves == 0 ? moves : 2*moves - 1;
+    return imax(ticks, s->p->slot_lo - tick);
+}
+
+static inline bool node_before(const struct node *a, const struct node *b) {
+    if (a->f != b->f)
+        return a->f < b->f;
+    if (a->g != b->g)
+        return a->g > b->g;         // Prefer the deeper of equals.
+    return a->seq < b->seq;
+}
+
+static void heap_push(struct search *s, const struct node *n) {
+    if (s->n_heap == s->heap_cap) {
+        const struct node **heap = arena_alloc(&search_arena,
+                                               2 * s->heap_cap *
+                                               sizeof(*heap));
+        memcpy(heap, s->heap, s->n_heap * sizeof(*heap));
+        s->heap = heap;
+        s->heap_cap *= 2;
+    }
+    int i = s->n_heap++;
+    while (i > 0) {
+        int parent = (i-1) / 2;
+        if (!node_before(n, s->heap[parent]))
+            break;
+        s->heap[i] = s->heap[parent];
+        i = parent;
+    }
+    s->heap[i] = n;
+}
+
+static const struct node *heap_pop(struct search *s) {
+    const struct node *rv = s->heap[0];
+    const struct node *last = s->heap[--s->n_heap];
+    int i = 0;
+    for (;;) {
+        int child = 2*i + 1;
+        if (child >= s->n_heap)
+            break;
+        if (child+1 < s->n_heap &&
+                node_before(s->heap[child+1], s->heap[child]))
+            child++;
+        if (!node_before(s->heap[child], last))
+            break;
+        s->heap[i] = s->heap[child];
+        i = child;
+    }
+    if (s->n_heap)
+        s->heap[i] = last;
+    return rv;
+}
+
+// Give the seen set a cleared table of 2^'bits' slots.
+static void alloc_seen(struct search *s, unsigned int bits) {
+    s->seen = arena_alloc(&search_arena, (1u << bits) * sizeof(*s->seen));
+    memset(s->seen, 0, (1u << bits) * sizeof(*s->seen));
+    s->seen_bits = bits;
+}
+
+// Where 'key' is in the seen set, or the empty slot it'd go in.
+static unsigned int *seen_slot(const struct search *s, unsigned int key) {
+    unsigned int mask = (1u << s->seen_bits) - 1;
+    unsigned int h = (key * 2654435761u) >> (32 - s->seen_bits);
+    for ( ; s->seen[h] && s->seen[h] != key; h = (h+1) & mask)
+        ;
+    return &s->seen[h];
+}
+
+// Double the seen set's table.
+static void grow_seen(struct search *s) {
+    const unsigned int *old = s->seen;
+    const unsigned int size = 1u << s->seen_bits;
+    alloc_seen(s, s->seen_bits + 1);
+    for (unsigned int i = 0; i < size; i++) {
+        if (old[i])
+            *seen_slot(s, old[i]) = old[i];
+    }
+}
+
+// Add the state to the set of those seen, returning whether it was new.
+// Every route to a given tick has the same cost, so a state only ever
+// needs to be reached once.
+static bool mark_seen(struct search *s, int row, int col, int alt,
+                      int bearing, int tick, bool cleared_exit) {
+    unsigned int key = ((((((unsigned) row << 7 | col) << 4 | alt) << 3 |
+                          bearing) << 1 | cleared_exit) << 9 |
+                        (tick - s->tick0)) + 1;
+    unsigned int *slot = seen_slot(s, key);
+    if (*slot)
+        return false;
+    if (2 * (s->n_seen + 1) > 1u << s->seen_bits &&
+            s->seen_bits < HASH_BITS) {
+        grow_seen(s);
+        slot = seen_slot(s, key);
+    }
+    *slot = key;
+    s->n_seen++;
+    return true;
+}
+
+static void add_node(struct search *s, const struct node *parent,
+                     int row, int col, int alt, int bearing,
+                     bool cleared_exit) {
+    int tick = parent->tick + 1;
+    if (!cleared_exit && clears_exit(row, col, alt))
+        cleared_exit = true;
+    int h = heuristic(s, tick, row, col, alt, bearing, cleared_exit);
+    if (h < 0 || !mark_seen(s, row, col, alt, bearing, tick, cleared_exit))
+        return;
+
+    struct node *n = arena_alloc(&search_arena, sizeof(*n));
+    n->parent = parent;
+    n->tick = tick;
+    n->g = parent->g + 1;
+    n->f = n->g + (int) (astar_weight * h + 0.5);
+    n->seq = s->n_nodes++;
+    n->row = row;  n->col = col;  n->alt = alt;  n->bearing = bearing;
+    n->cleared_exit = cleared_exit;
+    s->newest = n;
+    heap_push(s, n);
+}
+
+static void expand(struct search *s, const struct node *n) {
+    const struct plane *p = s->p;
+    const int tick = n->tick + 1;
+
+    // Props don't move on odd ticks, except to pop out of an exit.
+    if (!p->isjet && tick%2 == 1 && n->row != 0 && n->col != 0 &&
+            n->row != board_height-1 && n->col != board_width-1) {
+        add_node(s, n, n->row, n->col, n->alt, n->bearing, n->cleared_exit);
+        return;
+    }
+
+    // At the airport, the plane can only hold or take off.
+    if (n->alt == 0) {
+        add_node(s, n, n->row, n->col, 0, n->bearing, n->cleared_exit);
+        struct xy rc = apply(n->row, n->col, n->bearing);
+        if (resv_adjacent(rc, 1, p->isjet, tick).alt < 0)
+            add_node(s, n, rc.row, rc.col, 1, n->bearing, n->cleared_exit);
+        return;
+    }
+
+    for (int turn = -2; turn <= 2; turn++) {
+        int nb = (n->bearing + turn) & 7;
+        struct xy rc = apply(n->row, n->col, nb);
+        for (int nalt = n->alt-1; nalt <= n->alt+1; nalt++) {
+            struct blp blocker;
+            enum move_kind mk = check_move(p, n->row, n->col, n->alt, rc,
+                                           nalt, s->target, n->cleared_exit,
+                                           tick, &blocker);
+            if (mk == MOVE_OK || mk == MOVE_EXIT)
+                add_node(s, n, rc.row, rc.col, nalt, nb, n->cleared_exit);
+        }
+    }
+}
+
+// Lay down the course from the root to 'last'.
+static void lay_course(struct plane *p, const struct node *root,
+                       const struct node *last) {
+    int len = last->tick - root->tick;
+    const struct node *path[len+1];
+    for (const struct node *n = last; n != root; n = n->parent)
+        path[n->tick - root->tick - 1] = n;
+
+    for (int i = 0; i < len; i++) {
+        const struct node *n = path[i];
+        add_course_elem(p, n->row, n->col, n->alt, n->bearing,
+                        n->parent->cleared_exit, 0);
+    }
+    p->end_tm = last->tick;
+}
+
+// Plan 'p's course on from its last entry, at 'tick'.  Once 'deadline'
+// passes, settle for the route to the expanded node nearest the target.
+enum plan_result astar_course(struct plane *p, int tick,
+                              const struct timespec *deadline) {
+    assert(search_arena.in_use == 0);
+    const struct course *start = course_end(p);
+    const bool trace = tracing(p, start->pos.row, start->pos.col, tick);
+    struct search s = { .p = p, .target = plane_target(p),
+                        .tick0 = tick, .n_heap = 0, .heap_cap = MIN_HEAP,
+                        .n_seen = 0, .n_nodes = 0 };
+    s.heap = arena_alloc(&search_arena, MIN_HEAP * sizeof(*s.heap));
+    alloc_seen(&s, MIN_HASH_BITS);
+
+    struct node *root = arena_alloc(&search_arena, sizeof(*root));
+    root->parent = NULL;
+    root->tick = tick;
+    root->g = 0;
+    root->seq = s.n_nodes++;
+    root->row = start->pos.row;  root->col = start->pos.col;
+    root->alt = start->pos.alt;
+    root->bearing = start->bearing;
+    root->cleared_exit = start->cleared_exit ||
+                         clears_exit(root->row, root->col, root->alt);
+    root->f = imax(heuristic(&s, tick, root->row, root->col, root->alt,
+                             root->bearing, root->cleared_exit), 0);
+    mark_seen(&s, root->row, root->col, root->alt, root->bearing, tick,
+              root->cleared_exit);
+    heap_push(&s, root);
+    TRACE(trace, "A* tracing plane %c's course from %d:(%d, %d, %d)@%d to "
+                 "(%d, %d, %d)\n", p->id, tick, root->row, root->col,
+          root->alt, bearings[root->bearing].degree,
+          s.target.row, s.target.col, s.target.alt);
+
+    int expansions = 0;
+    const struct node *best = NULL, *best_next = NULL;
+    while (s.n_heap) {
+        const struct node *n = heap_pop(&s);
+        if (n->row == s.target.row && n->col == s.target.col &&
+                n->alt == s.target.alt) {
+            lay_course(p, root, n);
+            finish_course(p, n->tick + 1, n->cleared_exit, trace);
+            arena_reset(&search_arena);
+            count_route(expansions, 0, p->isjet ? n->g : (n->g + 1) / 2,
+                        false);
+            if (verbose) {
+                fprintf(logff, "A* plan for plane '%c' at time %d: %d "
+                               "expansions, %d ticks.\n",
+                        p->id, frame_no, expansions, n->g);
+            }
+            if (!quiet && !plan_tally) {
+                pthread_mutex_lock(&record_lock);
+                if (expansions > rec_expansions) {
+                    rec_expansions = expansions;
+                    fprintf(logff, "New record A* search: plane '%c' at "
+                                   "time %d in %d expansions/%d ticks.\n",
+                            p->id, frame_no, expansions, n->g);
+                    log_course(p);
+                }
+                pthread_mutex_unlock(&record_lock);
+            }
+            return PLAN_FOUND;
+        }
+        if (search_cancelled()) {     // Another strategy's won the race.
+            arena_reset(&search_arena);
+            return PLAN_NONE;
+        }
+        if (expansions == MAX_EXPANSIONS)
+            break;
+        expansions++;
+        TRACE(trace, "\tExpanding %d:(%d, %d, %d)@%d g=%d f=%d\n",
+              n->tick, n->row, n->col, n->alt, bearings[n->bearing].degree,
+              n->g, n->f);
+        if (n->tick - frame_no >= MAX_TICKS)
+            continue;
+
+        // A node with a child has a free move onward, so it'll do as the
+        // end of a partial route -- but for a prop, only if the child's a
+        // move and not a hold.
+        unsigned int n_nodes = s.n_nodes;
+        expand(&s, n);
+        if (s.n_nodes > n_nodes && n->tick - tick >= MIN_PREFIX &&
+                (p->isjet || n->tick%2 == 1) &&
+                (best == NULL || n->f - n->g < best->f - best->g ||
+                 (n->f - n->g == best->f - best->g && n->g > best->g))) {
+            best = n;
+            best_next = s.newest;
+        }
+        if (deadline && best && past_deadline(deadline)) {
+            lay_course(p, root, best_next);
+            end_partial(p, best->tick);
+            arena_reset(&search_arena);
+            return PLAN_PARTIAL;
+        }
+    }
+
+    arena_reset(&search_arena);
+    fprintf(logff, "A* failed to route plane '%c' at time %d after %d "
+                   "expansions; falling back to the greedy search.\n",
+            p->id, frame_no, expansions);
+    return PLAN_NONE;
+}
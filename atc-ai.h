@@ -4,13 +4,17 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
 
 extern int get_ptm(void);
 extern int spawn(const char *cmd, const char *args[], int ptm);
 extern void update_display(const char *, int);
 extern bool update_board(bool do_mark);
+extern bool plan_frame(const struct timespec *until);
+extern bool frame_planning;
 extern void cleanup(void);
 extern int testmain(void);
+extern int benchmain(void);
 extern void vwrite(int, const char *, int);
 
 __attribute__((noreturn, format(printf, 2, 3) ))
@@ -28,7 +32,7 @@ extern char erase_char;
 #define AIRPORT_MAX 10
 
 struct xy { int row, col; };
-struct xyz { int row, col, alt; };
+struct xyz { signed char row, col, alt; };     // Board coordinates fit.
 struct exitspec {
     int num;
     int row, col;
@@ -72,26 +76,66 @@ extern struct airport airports[AIRPORT_MAX];
 extern int n_airports;
 extern struct airport *get_airport(int n);
 
+// One tick of a plane's course.  A course is an array of these, packed
+// so that walking it stays within a cache line or two.
 struct course {
     struct xyz pos;
-    int bearing;
-    bool cleared_exit, at_exit;
-    struct course *prev, *next;
+    signed char bearing;        // -1 once landed.
+    bool cleared_exit:1, at_exit:1;
 };
 
-extern struct course *free_course_entry(struct course *);
-
 struct plane {
     char id;
     bool isjet;
     bool target_airport;
     int target_num;
-    struct course *start, *current, *end;
+    struct course *course;      // Entry 'i' is where it is at start_tm+i.
+    int len, cap;
     int start_tm, current_tm, end_tm;
+    bool pending;               // Course stops short; see resume_courses().
+    int slot_lo;                // Earliest arrival slot; see slots.c.
     struct plane *prev, *next;
 };
 
-extern void plot_course(struct plane *, int row, int col, int alt);
+static inline struct course *course_at(const struct plane *p, int tick) {
+    return &p->course[tick - p->start_tm];
+}
+
+static inline struct course *course_end(const struct plane *p) {
+    return &p->course[p->len - 1];
+}
+
+static inline int last_tick(const struct plane *p) {
+    return p->start_tm + p->len - 1;
+}
+
+extern void free_course(struct plane *);
+extern int n_courses, n_courses_hiwater;
+
+extern bool plot_course(struct plane *, int row, int col, int alt);
+
+enum planner_kind { PLANNER_GREEDY, PLANNER_ASTAR, PLANNER_BIDIR,
+                    PLANNER_HIER, PLANNER_PORTFOLIO };
+extern enum planner_kind planner;
+extern double astar_weight;
+extern bool coop_replan;
+extern bool fly_funnels;
+extern void workers_init(int n);
+extern bool idle_planning;
+extern bool precompute_step(void);
+extern bool shadow_mode;
+extern enum planner_kind shadow_planner;
+extern const char *shadow_file_name;
+extern bool shadow_step(void);
+extern void log_shadow(void);
+extern void start_plan_clock(unsigned int budget_ms);
+extern bool set_trace(const char *spec);
+extern bool set_heuristics(const char *spec);
+extern void format_heuristics(char *buf, size_t size);
+extern void log_plan_totals(void);
+extern void log_portfolio(const char *board);
+extern int tune(const char *corpus, const char *self, const char *atc_cmd,
+                int jobs, int frames);
 
 // The board's dynamic state.
 extern int frame_no;
@@ -33,6 +33,16 @@ int n_airports = 0;
 int frame_no = 0;
 struct plane *plstart = NULL, *plend = NULL;
 
+// The planes which have appeared this tick, to be routed together and
+// then launched by plan_frame().
+static struct plane *new_planes[52];
+static int n_new_planes;
+
+// Whether this tick's routes are still being planned, and whether to mark
+// the tick once they're done.
+bool frame_planning;
+static bool frame_do_mark;
+
 
 static void handle_new_plane(char code, int row, int col, int alt);
 static struct plane *get_plane(char code);
@@ -162,28 +172,15 @@ static bool board_init() {
     }
 
     find_airports();
+    cells_init();
+    resv_init();
+    costmap_init();
     fprintf(logff, "Board is %d by %d and the info column is %d.\n",
         board_width, board_height, info_col);
 
     return true;
 }
 
-struct airport *get_airport(int n) {
-    for (int i = 0; i < n_airports; i++) {
-        if (airports[i].num == n)
-            return &airports[i];
-    }
-    return NULL;
-}
-
-struct exitspec *get_exit(int n) {
-    for (int i = 0; i < n_exits; i++) {
-        if (exits[i].num == n)
-            return &exits[i];
-    }
-    return NULL;
-}
-
 static void new_exit(int row, int col) {
     int exit_num = D(row, 2*col) - '0';
     struct exitspec *spec = get_exit(exit_num);
@@ -200,6 +197,8 @@ static void new_exit(int row, int col) {
     spec->num = exit_num; spec->row = row; spec->col = col;
     if (verbose)
         fprintf(logff, "Found exit %d at (%d, %d)\n", exit_num, row, col);
+    cells_add_exit(spec);
+    costmap_add_exit(spec);
 }
 
 static void check_for_exits() {
@@ -226,23 +225,10 @@ static void check_for_exits() {
     }
 }
 
-struct course *free_course_entry(struct course *ci) {
-    struct course *rv = ci->next;
-    assert(ci->prev == NULL);
-    if (ci->next)
-        ci->next->prev = ci->prev;
-    free(ci);
-    return rv;
-}
-
-void remove_course_entries(struct course *c) {
-    while (c)
-        c = free_course_entry(c);
-}
-
 static struct plane *remove_plane(struct plane *p) {
     struct plane *rv = p->next;
-    remove_course_entries(p->start);
+    resv_remove_course(p, p->current_tm);
+    free_course(p);
     if (p->prev)
         p->prev->next = p->next;
     else {
@@ -273,49 +259,49 @@ static bool southbound_airport(char code, int alt, int row, int col) {
 static void verify_planes() {
     for (struct plane *i = plstart; i; ) {
         assert(i->current_tm == frame_no);
-        struct course *next = i->current->next;
-        if (!next) {
+        if (last_tick(i) == frame_no) {
             assert(i->end_tm == frame_no);
             i = remove_plane(i);
             continue;
         }
+        const struct course *cur = course_at(i, frame_no), *next = cur + 1;
         if (next->pos.alt == -2)
             land_at_airport(i->id, i->target_num);
         else {
-            if (i->current->bearing != next->bearing)
+            if (cur->bearing != next->bearing)
                 order_new_bearing(i->id, next->bearing);
-            if (i->current->pos.alt != next->pos.alt)
+            if (cur->pos.alt != next->pos.alt)
                 order_new_altitude(i->id, next->pos.alt);
         }
 
-        char code = D(i->current->pos.row, i->current->pos.col*2);
-        char alt = D(i->current->pos.row, i->current->pos.col*2+1);
-        if (i->current->pos.alt == 0) {
+        char code = D(cur->pos.row, cur->pos.col*2);
+        char alt = D(cur->pos.row, cur->pos.col*2+1);
+        if (cur->pos.alt == 0) {
             if (!isdigit(alt) || (!isalpha(code) && !memchr("<>^v", code, 4))) {
                 fprintf(logff, "[Tick %d] Expected to find plane '%c' at "
                                "(%d, %d) but instead found '%c%c'\n",
                         frame_no, i->id,
-                        i->current->pos.row, i->current->pos.col, code, alt);
+                        cur->pos.row, cur->pos.col, code, alt);
                 errexit('p', "Found '%c%c' where expected to find a "
                              "plane or airport.", code, alt);
             }
         } else if (!isalpha(code) || !isdigit(alt)) {
             fprintf(logff, "[Tick %d] Expected to find plane '%c' at "
                            "(%d, %d) but instead found '%c%c'\n",
-                    frame_no, i->id, i->current->pos.row, i->current->pos.col,
+                    frame_no, i->id, cur->pos.row, cur->pos.col,
                     code, alt);
             errexit('p', "Found '%c%c' where expected to find a plane.",
                     code, alt);
         }
-        if (code == i->id && alt-'0' != i->current->pos.alt &&
+        if (code == i->id && alt-'0' != cur->pos.alt &&
                 !southbound_airport(code, alt-'0',
-                                    i->current->pos.row, i->current->pos.col)) {
+                                    cur->pos.row, cur->pos.col)) {
             fprintf(logff, "Found plane '%c' at altitude %c=%d where "
                            "expected to find it at altitude %d\n",
-                    code, alt, alt-'0', i->current->pos.alt);
+                    code, alt, alt-'0', cur->pos.alt);
             errexit('a', "Found plane %c at altitude %c=%d where "
                          "expected to find it at altitude %d.",
-                    code, alt, alt-'0', i->current->pos.alt);
+                    code, alt, alt-'0', cur->pos.alt);
         }
         i = i->next;
     }
@@ -335,7 +321,8 @@ static void check_pldt() {
 
 static inline bool plane_at_airport(char id) {
     struct plane *p = get_plane(id);
-    return p->id == id && p->current && p->current->pos.alt == 0;
+    return p->id == id && p->len &&
+           course_at(p, p->current_tm)->pos.alt == 0;
 }
 
 static void handle_airport_plane(char id, int dtpos) {
@@ -386,6 +373,10 @@ static struct plane *get_plane(char code) {
         if (i->id == code)
             return i;
     }
+    for (int i = 0; i < n_new_planes; i++) {
+        if (new_planes[i]->id == code)
+            return new_planes[i];
+    }
 
     return NULL;
 }
@@ -399,7 +390,7 @@ static void handle_found_plane(char code, int alt, int row, int col) {
     struct plane *p = get_plane(code);
 
     if (p) {
-        struct xyz pos = p->current->pos;
+        struct xyz pos = course_at(p, p->current_tm)->pos;
         if (pos.alt != alt || pos.row != row || pos.col != col) {
             fprintf(logff, "[Tick %d] Expected to find plane '%c' at "
                            "(%d, %d, %d) but actually at (%d, %d, %d)\n",
@@ -424,21 +415,26 @@ static void handle_new_plane(char code, int row, int col, int alt) {
     p->id = code;
     p->isjet = islower(code);
     target(p);
-    plot_course(p, row, col, alt);
-    if (p->start) {
-        assert(p->start->pos.alt == alt);
-        assert(p->start->pos.row == row);
-        assert(p->start->pos.col == col);
-        struct course *next = p->start->next;
-        if (next) {
-            if (alt)
-                order_new_bearing(p->id, next->bearing);
-            if (next->pos.alt != alt)
-                order_new_altitude(p->id, next->pos.alt);
-        }
-        p->current = p->start;
-        p->current_tm = p->start_tm;
+    start_course(p, row, col, alt);
+    shadow_note(p);
+    assert(n_new_planes < 52);
+    new_planes[n_new_planes++] = p;
+}
+
+static void launch_plane(struct plane *p) {
+    if (!p->pending) {
+        repair_course(p);
+        resolve_contention(p);
+    }
+    int alt = p->course[0].pos.alt;
+    if (p->len > 1) {
+        const struct course *next = &p->course[1];
+        if (alt)
+            order_new_bearing(p->id, next->bearing);
+        if (next->pos.alt != alt)
+            order_new_altitude(p->id, next->pos.alt);
     }
+    p->current_tm = p->start_tm;
 
     p->next = NULL;
     p->prev = plend;
@@ -468,12 +464,64 @@ static void find_new_planes() {
 
 static void update_plane_courses() {
     for (struct plane *p = plstart; p; p = p->next) {
-        p->current = p->current->next;
+        resv_unstamp(p->id, course_at(p, p->current_tm), p->current_tm);
         p->current_tm++;
     }
 }
 
+// Carry on planning this tick's routes until 'until' (or for as long as it
+// takes, if it's NULL), and once they're done, launch the new planes and
+// move on to the next tick.  Returns whether the tick's done.
+bool plan_frame(const struct timespec *until) {
+    if (!frame_planning)
+        return true;
+    if (!plan_slice(until))
+        return false;
+    frame_planning = false;
+
+    for (int i = 0; i < n_new_planes; i++)
+        launch_plane(new_planes[i]);
+    n_new_planes = 0;
+    update_plane_courses();
+    if (skip_tick) {
+        next_tick();
+        if (frame_do_mark)
+            mark_msg();
+    }
+
+    if (!quiet && frame_no % 1024u == 0) {
+        fprintf(logff, "n_malloc = %d; n_free = %d; difference = %d\n",
+                n_malloc, n_free, n_malloc - n_free);
+        fprintf(logff, "Course entries allocated = %d (high-water %d); "
+                       "search arena high-water = %zu bytes\n",
+                n_courses, n_courses_hiwater, search_arena.hiwater);
+        if (idle_planning) {
+            fprintf(logff, "Precomputed routes adopted = %d; missed = %d; "
+                           "course entries held = %d\n", n_adopted, n_missed,
+                    precomputed_courses());
+        }
+        if (n_workers > 1) {
+            fprintf(logff, "Planes planned in parallel = %d; replanned after "
+                           "a conflict = %d\n", n_parallel_planned,
+                    n_parallel_replanned);
+        }
+        fprintf(logff, "Landings flown down a funnel = %d; moves pruned "
+                       "short of a landing tree = %d\n", n_funnel_landings,
+                n_landing_prunes);
+        fprintf(logff, "Moves pruned off a block route = %d; searches "
+                       "retried without one = %d\n", n_route_prunes,
+                n_route_retries);
+        fprintf(logff, "Expansions pruned as dominated = %d\n",
+                n_dominance_prunes);
+        log_slots();
+    }
+    return true;
+}
+
+// Read a new tick's board, if 'atc' has put one up, and begin planning
+// for it.  The planning's finished by plan_frame().
 bool update_board(bool do_mark) {
+    plan_frame(NULL);
     if (frame_no == 0) {
         assert(mark_sent);
         assert(mark_sense);
@@ -525,17 +573,8 @@ bool update_board(bool do_mark) {
     verify_planes();
     find_new_planes();
     new_airport_planes();
-    update_plane_courses();
-    if (skip_tick) {
-        next_tick();
-        if (do_mark)
-            mark_msg();
-    }
-
-    if (!quiet && frame_no % 1024u == 0) {
-        fprintf(logff, "n_malloc = %d; n_free = %d; difference = %d\n",
-                n_malloc, n_free, n_malloc - n_free);
-    }
-
+    begin_planning(new_planes, n_new_planes);
+    frame_planning = true;
+    frame_do_mark = do_mark;
     return true;
 }
@@ -0,0 +1,122 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// The board's static properties, square by square, so that the move rules
+// come down to a table load or two instead of scanning the exits and
+// airports for every candidate move.  Rebuilt by cells_init() once the
+// board's size and airports are known, and added to by cells_add_exit()
+// as the exits are found.
+//
+// In front of each exit is its corridor:  The squares a new plane flies
+// through over its first few moves, straight in from the exit or a square
+// to either side.  Routes through it at the altitudes new planes appear at
+// pay a penalty (see "-H corridor"), so that the planes appearing there
+// mostly find the way clear.
+
+struct cell cells[CELLS_MAX_ROWS][CELLS_MAX_COLS];
+
+// The exits and airports by number.
+static struct exitspec *exit_index[EXIT_MAX];
+static struct airport *airport_index[AIRPORT_MAX];
+
+static inline int sgn(int x) {
+    if (x > 0)
+        return 1;
+    if (x < 0)
+        return -1;
+    return 0;
+}
+
+static inline bool on_board(int row, int col) {
+    return row >= 0 && col >= 0 && row < board_height && col < board_width;
+}
+
+// Is (row, col) within airport 'a's exclusion zone, for a plane at
+// altitude 1 or 2?  That's the squares it can be entered from, and the
+// whole half of the board behind it.
+static bool airport_excl(const struct airport *a, int row, int col) {
+    for (int i = 0; i < EZ_SIZE; i++) {
+        if (a->exc[i].row == row && a->exc[i].col == col)
+            return true;
+    }
+
+    if (bearings[a->bearing].dcol)
+        return sgn(col - a->col) == bearings[a->bearing].dcol;
+    else
+        return sgn(row - a->row) == bearings[a->bearing].drow;
+}
+
+void cells_init() {
+    if (board_height > CELLS_MAX_ROWS || board_width > CELLS_MAX_COLS) {
+        errexit('b', "Board of %d by %d is too big for the cell table.",
+                board_width, board_height);
+    }
+    for (int i = 0; i < EXIT_MAX; i++)
+        exit_index[i] = NULL;
+    for (int i = 0; i < AIRPORT_MAX; i++)
+        airport_index[i] = NULL;
+    for (int i = 0; i < n_airports; i++)
+        airport_index[airports[i].num] = &airports[i];
+
+    for (int row = 0; row < board_height; row++) {
+        for (int col = 0; col < board_width; col++) {
+            struct cell *c = &cells[row][col];
+            *c = (struct cell) { .exit_num = -1, .airport_num = -1 };
+            if (row == 0 || row == board_height-1 ||
+                    col == 0 || col == board_width-1)
+                c->flags |= CELL_BOUNDARY;
+            if (row <= 2 || row >= board_height-3 ||
+                    col <= 2 || col >= board_width-3)
+                c->flags |= CELL_EDGE_BAND;
+            for (int i = 0; i < n_airports; i++) {
+                if (airport_excl(&airports[i], row, col))
+                    c->excl |= 1u << airports[i].num;
+            }
+        }
+    }
+    for (int i = 0; i < n_airports; i++) {
+        if (on_board(airports[i].row, airports[i].col))
+            cells[airports[i].row][airports[i].col].airport_num =
+                airports[i].num;
+    }
+}
+
+void cells_add_exit(struct exitspec *e) {
+    exit_index[e->num] = e;
+    cells[e->row][e->col].exit_num = e->num;
+
+    const int b = start_bearing(e->row, e->col, 7);
+    if (b < 0)
+        return;
+    for (int d = 1; d <= CORRIDOR_DEPTH; d++) {
+        for (int side = -2; side <= 2; side += 2) {
+            const struct bearing *lat = &bearings[(b + side) & 7];
+            int row = e->row + d*bearings[b].drow + (side ? lat->drow : 0);
+            int col = e->col + d*bearings[b].dcol + (side ? lat->dcol : 0);
+            if (on_board(row, col))
+                cells[row][col].flags |= CELL_CORRIDOR;
+        }
+    }
+}
+
+struct airport *get_airport(int n) {
+    return n >= 0 && n < AIRPORT_MAX ? airport_index[n] : NULL;
+}
+
+struct exitspec *get_exit(int n) {
+    return n >= 0 && n < EXIT_MAX ? exit_index[n] : NULL;
+}
+
+bool is_exit_at(int row, int col) {
+    return on_board(row, col) && cells[row][col].exit_num >= 0;
+}
+
+struct airport *get_airport_xy(int row, int col) {
+    return on_board(row, col) ? get_airport(cells[row][col].airport_num)
+                              : NULL;
+}
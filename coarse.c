@@ -0,0 +1,123 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Coarse routes, for the hierarchical planner ("-R hier"):  On the larger
+// boards a long crossing takes the greedy search one square a tick, with
+// only a move's lookahead, and the traffic it backs out of can be the
+// traffic it could have seen coming from the other side of the board.  So
+// a long crossing is first routed on the coarse grid:  Blocks of squares,
+// each costing a hop to cross plus its load, the reserved positions in it
+// over the window of ticks the plane would be passing through, weighted
+// by "-H block_load".  The block route is the blocks that route passes
+// through and their neighbours, which the greedy search then keeps to,
+// refining it square by square with the usual move rules.
+//
+// Many routes across the grid take as many hops as the straight one, and
+// a block route that leaves the straight line long before the traffic
+// has the search turning away before its heuristic wants to.  So each
+// block also costs its distance off the straight line, to keep detours
+// about the traffic they go around.
+
+#define HOP_COST (2*BLOCK_SIZE)
+
+// How far block (row, col) is off the line from (r0, c0) to (rt, ct), in
+// blocks, near enough.
+static int off_line(int row, int col, int r0, int c0, int rt, int ct) {
+    int len = abs(rt - r0) > abs(ct - c0) ? abs(rt - r0) : abs(ct - c0);
+    if (len == 0)
+        return 0;
+    return abs((row - r0) * (ct - c0) - (col - c0) * (rt - r0)) / len;
+}
+
+// Is 'p's crossing, from its course's last entry, long enough to route
+// coarsely first?
+bool long_crossing(const struct plane *p) {
+    const struct course *c = course_end(p);
+    const struct xyz target = plane_target(p);
+    return abs(c->pos.row - target.row) >= HIER_MIN_MOVES ||
+           abs(c->pos.col - target.col) >= HIER_MIN_MOVES;
+}
+
+// Route 'p' from its course's last entry, at 'tick', across the coarse
+// grid, and put the blocks it may fly through in 'br'.  Returns false if
+// the crossing is too short to bother.
+bool coarse_route(const struct plane *p, int tick, struct block_route *br) {
+    if (!long_crossing(p))
+        return false;
+    const struct course *c = course_end(p);
+    const struct xyz target = plane_target(p);
+
+    const int b_rows = (board_height + BLOCK_SIZE-1) / BLOCK_SIZE;
+    const int b_cols = (board_width + BLOCK_SIZE-1) / BLOCK_SIZE;
+    const int ticks_per_block = p->isjet ? BLOCK_SIZE : 2*BLOCK_SIZE;
+    int cost[BLOCK_ROWS][BLOCK_COLS], hops[BLOCK_ROWS][BLOCK_COLS];
+    signed char from[BLOCK_ROWS][BLOCK_COLS];   // Bearing back, or -1.
+    bool done[BLOCK_ROWS][BLOCK_COLS];
+    for (int r = 0; r < b_rows; r++) {
+        for (int col = 0; col < b_cols; col++) {
+            cost[r][col] = INT_MAX;
+            from[r][col] = -1;
+            done[r][col] = false;
+        }
+    }
+    const int r0 = c->pos.row / BLOCK_SIZE, c0 = c->pos.col / BLOCK_SIZE;
+    const int rt = target.row / BLOCK_SIZE, ct = target.col / BLOCK_SIZE;
+    cost[r0][c0] = hops[r0][c0] = 0;
+
+    // Dijkstra's, scanning for the next block, as there are few of them.
+    for (;;) {
+        struct xy at = { -1, -1 };
+        for (int r = 0; r < b_rows; r++) {
+            for (int col = 0; col < b_cols; col++) {
+                if (!done[r][col] && cost[r][col] != INT_MAX &&
+                        (at.row < 0 || cost[r][col] < cost[at.row][at.col]))
+                    at = (struct xy) { r, col };
+            }
+        }
+        if (at.row < 0)
+            return false;
+        done[at.row][at.col] = true;
+        if (at.row == rt && at.col == ct)
+            break;
+
+        const int h = hops[at.row][at.col] + 1;
+        const int when = tick + h*ticks_per_block - ticks_per_block/2;
+        for (int b = 0; b < 8; b++) {
+            const struct xy n = apply(at.row, at.col, b);
+            if (n.row < 0 || n.col < 0 || n.row >= b_rows ||
+                    n.col >= b_cols || done[n.row][n.col])
+                continue;
+            int nc = cost[at.row][at.col] + HOP_COST +
+                     off_line(n.row, n.col, r0, c0, rt, ct) +
+                     search_heur->block_load_weight *
+                     resv_block_load(n.row, n.col, when);
+            if (nc < cost[n.row][n.col]) {
+                cost[n.row][n.col] = nc;
+                hops[n.row][n.col] = h;
+                from[n.row][n.col] = (b + 4) & 7;
+            }
+        }
+    }
+
+    memset(br, 0, sizeof *br);
+    br->n_hops = hops[rt][ct];
+    for (struct xy at = { rt, ct }; ; at = apply(at.row, at.col,
+                                                 from[at.row][at.col])) {
+        for (int r = at.row-1; r <= at.row+1; r++) {
+            for (int col = at.col-1; col <= at.col+1; col++) {
+                if (r >= 0 && col >= 0 && r < b_rows && col < b_cols)
+                    br->in[r][col] = true;
+            }
+        }
+        if (from[at.row][at.col] < 0)
+            break;
+    }
+    return true;
+}
@@ -0,0 +1,263 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Cost-to-go tables:  For each exit and airport, the fewest moves it
+// takes to get there from every (row, col, alt, bearing, cleared_exit),
+// ignoring the other planes.  They're computed by a breadth-first search
+// backwards from the target, using check_static_move(), so they know
+// about the boundary, the airports' exclusion walls, the 90 degree turn
+// limit, and keeping to altitude 9 or below 6 near the edges.  As every
+// real route is also a route on the empty board, they're a lower bound
+// on the moves a plane has left, and a state they can't reach is a
+// dead end.
+
+//
+// Landing funnels:  For each airport, the states within FUNNEL_DEPTH moves
+// of its target, each with the moves that take it a move closer.  They're
+// read off the airport's table as it's built.  A plane which gets into a
+// funnel can be flown the rest of the way in by looking up its moves,
+// taking whichever the traffic leaves free, instead of searching along the
+// exclusion wall for the way around to the target.
+
+#define N_ALT 10
+
+static unsigned char *exit_maps[EXIT_MAX], *airport_maps[AIRPORT_MAX];
+static int m_height, m_width;
+static unsigned int *queue;
+
+struct funnel_state {
+    unsigned int state;
+    unsigned short moves;       // Bit (turn+2)*3 + da+1 for each.
+};
+static struct funnel {
+    struct funnel_state *states;        // In order of state.
+    int n;
+} funnels[AIRPORT_MAX];
+
+static inline size_t n_states() {
+    return (size_t) m_height * m_width * N_ALT * 8 * 2;
+}
+
+static inline unsigned int state(int row, int col, int alt, int bearing,
+                                 bool cleared_exit) {
+    return (((row * m_width + col) * N_ALT + alt) * 8 + bearing) * 2 +
+           cleared_exit;
+}
+
+static unsigned char *build(const struct plane *p, struct xyz target) {
+    unsigned char *dist = malloc(n_states());
+    if (dist == NULL)
+        errexit('m', "Out of memory allocating a cost-to-go table.");
+    memset(dist, CTG_INF, n_states());
+
+    unsigned int head = 0, tail = 0;
+    for (int b = 0; b < 8; b++) {
+        for (int cl = 0; cl < 2; cl++) {
+            unsigned int s = state(target.row, target.col, target.alt, b, cl);
+            dist[s] = 0;
+            queue[tail++] = s;
+        }
+    }
+
+    while (head < tail) {
+        unsigned int s = queue[head++];
+        int d = dist[s] + 1;
+        if (d >= CTG_INF)
+            continue;
+        bool ncleared = s & 1;
+        int nb = (s >> 1) & 7;
+        unsigned int rest = s >> 4;
+        int nalt = rest % N_ALT;
+        rest /= N_ALT;
+        struct xy rc = { .row = rest / m_width, .col = rest % m_width };
+
+        // Which states could have moved here?  They were one square back
+        // along 'nb', at most one altitude away, and turned by at most
+        // 90 degrees.
+        int row = rc.row - bearings[nb].drow;
+        int col = rc.col - bearings[nb].dcol;
+        if (row < 0 || col < 0 || row >= m_height || col >= m_width)
+            continue;
+        bool clears = clears_exit(rc.row, rc.col, nalt);
+        for (int alt = nalt-1; alt <= nalt+1; alt++) {
+            if (alt < 1 || alt >= N_ALT)
+                continue;
+            for (int cl = 0; cl < 2; cl++) {
+                if ((cl || clears) != ncleared)
+                    continue;
+                enum move_kind mk = check_static_move(p, row, col, alt, rc,
+                                                      nalt, target, cl);
+                if (mk != MOVE_OK && mk != MOVE_EXIT)
+                    continue;
+                for (int turn = -2; turn <= 2; turn++) {
+                    unsigned int ps = state(row, col, alt, (nb - turn) & 7, cl);
+                    if (dist[ps] == CTG_INF) {
+                        dist[ps] = d;
+                        queue[tail++] = ps;
+                    }
+                }
+            }
+        }
+    }
+
+    return dist;
+}
+
+// The moves from 'state' at distance 'd' in 'dist' which take 'p' to a
+// state at distance d-1.
+static unsigned short closer_moves(const struct plane *p, struct xyz target,
+                                   const unsigned char *dist,
+                                   unsigned int s, int d) {
+    bool cleared = s & 1;
+    int bearing = (s >> 1) & 7;
+    unsigned int rest = s >> 4;
+    int alt = rest % N_ALT;
+    rest /= N_ALT;
+    int row = rest / m_width, col = rest % m_width;
+
+    unsigned short moves = 0;
+    for (int turn = -2; turn <= 2; turn++) {
+        int nb = (bearing + turn) & 7;
+        struct xy rc = apply(row, col, nb);
+        if (rc.row < 0 || rc.col < 0 || rc.row >= m_height ||
+                rc.col >= m_width)
+            continue;
+        for (int da = -1; da <= 1; da++) {
+            int nalt = alt + da;
+            if (nalt < 1 || nalt >= N_ALT)
+                continue;
+            if (check_static_move(p, row, col, alt, rc, nalt, target,
+                                  cleared) != MOVE_OK)
+                continue;
+            bool ncleared = cleared || clears_exit(rc.row, rc.col, nalt);
+            if (dist[state(rc.row, rc.col, nalt, nb, ncleared)] == d-1)
+                moves |= 1u << ((turn+2)*3 + da+1);
+        }
+    }
+    return moves;
+}
+
+static struct funnel build_funnel(const struct plane *p, struct xyz target,
+                                  const unsigned char *dist) {
+    struct funnel f = { .states = NULL, .n = 0 };
+    for (unsigned int s = 0; s < n_states(); s++) {
+        if (dist[s] > 0 && dist[s] <= FUNNEL_DEPTH)
+            f.n++;
+    }
+    f.states = malloc(f.n * sizeof(*f.states));
+    if (f.states == NULL)
+        errexit('m', "Out of memory allocating a landing funnel.");
+    int n = 0;
+    for (unsigned int s = 0; s < n_states(); s++) {
+        if (dist[s] > 0 && dist[s] <= FUNNEL_DEPTH) {
+            f.states[n].state = s;
+            f.states[n++].moves = closer_moves(p, target, dist, s, dist[s]);
+        }
+    }
+    return f;
+}
+
+static void free_maps() {
+    for (int i = 0; i < EXIT_MAX; i++) {
+        if (exit_maps[i])
+            free(exit_maps[i]);
+        exit_maps[i] = NULL;
+    }
+    for (int i = 0; i < AIRPORT_MAX; i++) {
+        if (airport_maps[i])
+            free(airport_maps[i]);
+        airport_maps[i] = NULL;
+        if (funnels[i].states)
+            free(funnels[i].states);
+        funnels[i] = (struct funnel) { .states = NULL, .n = 0 };
+    }
+    if (queue)
+        free(queue);
+    queue = NULL;
+}
+
+// Build the tables and funnels for the board's airports.  The exits'
+// tables come as check_for_exits() finds them.
+void costmap_init() {
+    free_maps();
+    m_height = board_height;
+    m_width = board_width;
+    queue = malloc(n_states() * sizeof(*queue));
+    if (queue == NULL)
+        errexit('m', "Out of memory allocating the cost-to-go queue.");
+
+    for (int i = 0; i < n_airports; i++) {
+        struct plane p = { .target_airport = true,
+                           .target_num = airports[i].num };
+        airport_maps[airports[i].num] = build(&p, plane_target(&p));
+        funnels[airports[i].num] = build_funnel(&p, plane_target(&p),
+                                                airport_maps[airports[i].num]);
+    }
+}
+
+void costmap_add_exit(const struct exitspec *e) {
+    if (queue == NULL || exit_maps[e->num])
+        return;
+    struct plane p = { .target_airport = false, .target_num = e->num };
+    exit_maps[e->num] = build(&p, plane_target(&p));
+}
+
+void costmap_clear() {
+    free_maps();
+}
+
+// The fewest moves for 'p' to get to its target from the given state,
+// CTG_INF if it can't be done, or -1 if there's no table to say.
+int cost_to_go(const struct plane *p, int row, int col, int alt,
+               int bearing, bool cleared_exit) {
+    const unsigned char *dist = p->target_airport ?
+            airport_maps[p->target_num] : exit_maps[p->target_num];
+    if (dist == NULL || alt < 1 || alt >= N_ALT)
+        return -1;
+    assert(row >= 0 && col >= 0 && row < m_height && col < m_width);
+    return dist[state(row, col, alt, bearing, cleared_exit)];
+}
+
+static int statecmp(const void *a, const void *b) {
+    unsigned int sa = *(const unsigned int *) a;
+    unsigned int sb = ((const struct funnel_state *) b)->state;
+    return sa < sb ? -1 : sa > sb;
+}
+
+// The index in airport-bound 'p's landing funnel of the given state, or
+// -1 if it's not in the funnel.
+int funnel_index(const struct plane *p, int row, int col, int alt,
+                 int bearing, bool cleared_exit) {
+    const struct funnel *f = &funnels[p->target_num];
+    if (!p->target_airport || f->states == NULL || alt < 1 || alt >= N_ALT)
+        return -1;
+    unsigned int s = state(row, col, alt, bearing, cleared_exit);
+    const struct funnel_state *fs = bsearch(&s, f->states, f->n,
+                                            sizeof(*f->states), statecmp);
+    return fs ? fs - f->states : -1;
+}
+
+int funnel_size(const struct plane *p) {
+    return p->target_airport ? funnels[p->target_num].n : 0;
+}
+
+// The moves of the state at 'i' in 'p's landing funnel, as bits
+// (turn+2)*3 + da+1.
+unsigned int funnel_moves_at(const struct plane *p, int i) {
+    return funnels[p->target_num].states[i].moves;
+}
+
+// The moves of airport-bound 'p's landing funnel from the given state,
+// or 0 if the state's not in the funnel.
+unsigned int funnel_moves(const struct plane *p, int row, int col, int alt,
+                          int bearing, bool cleared_exit) {
+    int i = funnel_index(p, row, col, alt, bearing, cleared_exit);
+    return i < 0 ? 0 : funnel_moves_at(p, i);
+}
@@ -0,0 +1,85 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Landing trees, for the bidirectional planner ("-R bidir"):  A landing
+// is most constrained at its end, where the plane has to come in along
+// the runway's approach at altitude 1, and a forward search only finds
+// out that the traffic's in the way there once it gets there.  So the
+// search also grows a tree backward from the landing, over the states of
+// the airport's landing funnel, each at the ticks from which its moves
+// toward the target are free all the way in.  The forward search meets
+// the tree when it enters the funnel:  A candidate move into a funnel
+// state which can't be flown in from at its tick is dropped, and one into
+// a state which can is followed the rest of the way by the tree's moves.
+//
+// The tree is grown lazily, state and tick as the forward search asks,
+// since it only ever asks about the few ticks around its arrival.  Ticks
+// outside the window, and states outside the funnel, are taken to reach.
+
+void landing_begin(struct landing_tree *lt, const struct plane *p, int tick) {
+    *lt = (struct landing_tree) { .p = p, .target = plane_target(p),
+                                  .base = tick, .known = NULL, .ok = NULL,
+                                  .n_states = funnel_size(p) };
+}
+
+static void landing_alloc(struct landing_tree *lt) {
+    size_t size = lt->n_states * sizeof(*lt->known);
+    lt->known = arena_alloc(&search_arena, 2*size);
+    lt->ok = lt->known + lt->n_states;
+    memset(lt->known, 0, size);
+}
+
+// Can the plane at (row, col, alt) heading 'bearing' at 'tick' be flown
+// in from there by the funnel's moves, as the traffic stands?
+bool landing_reaches(struct landing_tree *lt, int row, int col, int alt,
+                     int bearing, bool cleared_exit, int tick) {
+    const struct plane *p = lt->p;
+    if (row == lt->target.row && col == lt->target.col &&
+            alt == lt->target.alt)
+        return true;
+    if (tick < lt->base || tick >= lt->base + LANDING_WINDOW)
+        return true;
+    int i = funnel_index(p, row, col, alt, bearing, cleared_exit);
+    if (i < 0)
+        return true;
+    if (lt->known == NULL)
+        landing_alloc(lt);
+    const unsigned long long bit = 1ull << (tick - lt->base);
+    if (lt->known[i] & bit)
+        return lt->ok[i] & bit;
+
+    bool reaches = false;
+    if (!p->isjet && (tick+1)%2 == 1) {
+        // A prop keeps its place on odd ticks.
+        reaches = landing_reaches(lt, row, col, alt, bearing, cleared_exit,
+                                  tick+1);
+    } else {
+        const unsigned int lanes = funnel_moves_at(p, i);
+        for (int lane = 0; lane < 15 && !reaches; lane++) {
+            if (!(lanes & 1u << lane))
+                continue;
+            const int nb = (bearing + lane/3 - 2) & 7;
+            const int nalt = alt + lane%3 - 1;
+            const struct xy rc = apply(row, col, nb);
+            struct blp blocker;
+            if (check_move(p, row, col, alt, rc, nalt, lt->target,
+                           cleared_exit, tick+1, &blocker) != MOVE_OK)
+                continue;
+            reaches = landing_reaches(lt, rc.row, rc.col, nalt, nb,
+                                      cleared_exit ||
+                                      clears_exit(rc.row, rc.col, nalt),
+                                      tick+1);
+        }
+    }
+
+    lt->known[i] |= bit;
+    if (reaches)
+        lt->ok[i] |= bit;
+    return reaches;
+}
@@ -27,6 +27,7 @@
 #define DEF_IMIN 0
 #define DEF_IMAX 900
 #define DEF_MARK_THRESHOLD 50
+#define DEF_TUNE_FRAMES 2000
 #define STR(x) XSTR(x)
 #define XSTR(x) #x
 #undef CTRL
@@ -106,6 +107,11 @@ static void shutdown_atc(int signo) {
 }
 
 static void exit_hand() {
+    log_plan_totals();
+    if (planner == PLANNER_PORTFOLIO)
+        log_portfolio(game);
+    if (shadow_mode)
+        log_shadow();
     shutdown_atc(SIGINT);
     atc_pid = 0;
     cleanup();
@@ -212,8 +218,32 @@ static inline void newdelay(int nd) {
         fprintf(logff, "Setting frame delay to %d.\n", delay_ms);
 }
 
+// A trace selection being typed in after a 't', or -1 if none is.
+static char trace_spec[40];
+static int trace_len = -1;
+
+static void handle_trace_char(char c) {
+    if (c != '\r' && c != '\n') {
+        if (trace_len < (int) sizeof(trace_spec) - 1)
+            trace_spec[trace_len++] = c;
+        return;
+    }
+    trace_spec[trace_len] = '\0';
+    trace_len = -1;
+    if (!set_trace(trace_spec)) {
+        vwrite(1, "\a", 1);
+        return;
+    }
+    fprintf(logff, "[Tick %d] Trace selection set to '%s'.\n", frame_no,
+            trace_spec);
+}
+
 #define CNTRL(x) (x-'A'+1)
 static void handle_input_char(char c) {
+    if (trace_len >= 0) {
+        handle_trace_char(c);
+        return;
+    }
     switch (c) {
         case CNTRL('C'):
             raise(SIGINT);
@@ -233,6 +263,9 @@ static void handle_input_char(char c) {
         case '/':
             newdelay(delay_ms/2);
             break;
+        case 't':
+            trace_len = 0;
+            break;
         default:
             vwrite(1, "\a", 1);
             break;
@@ -268,10 +301,39 @@ static inline void set_timeval_from_ms(struct timeval *tv, unsigned int ms) {
     tv->tv_usec = (ms % 1000) * 1000;
 }
 
+// The time 'tv' from now, in 'ts'.
+static const struct timespec *timespec_after(struct timespec *ts,
+                                             const struct timeval *tv) {
+    clock_gettime(CLOCK_MONOTONIC, ts);
+    ts->tv_nsec += tv->tv_usec * 1000L;
+    ts->tv_sec += tv->tv_sec + ts->tv_nsec / 1000000000L;
+    ts->tv_nsec %= 1000000000L;
+    return ts;
+}
+
+// The planning time for a frame:  Half of what's left of it once the
+// keystrokes queued are typed, leaving the rest for typing in the orders
+// the planning comes up with.  Never 0, which would be no limit at all.
+static unsigned int plan_budget_ms() {
+    if (!delay_ms)
+        return 0;
+    unsigned int typing_ms = (tqtail-tqhead)%TQ_SIZE * typing_delay_ms;
+    if (typing_ms >= delay_ms)
+        return 1;
+    return (delay_ms - typing_ms + 1) / 2;
+}
+
 static void check_update(struct timeval *deadline, struct timeval *last_atc) {
     if (shutting_down)
         return;
+    start_plan_clock(plan_budget_ms());
     if (update_board(delay_ms <= mark_threshold)) {
+        // Counting the orders for the planes already flying, now queued.
+        start_plan_clock(plan_budget_ms());
+        // Unless the orders are typed a character at a time, there's
+        // nothing to plan between.
+        if (!delay_ms || !typing_delay_ms)
+            plan_frame(NULL);
         if (frame_no == duration_frame)
             shutdown_atc(SIGINT);
         else if (saved_planes >= duration_planes) {
@@ -306,6 +368,7 @@ static noreturn void mainloop(int pfd) {
     int maxfd = 0;
     fd_set fds;
     FD_ZERO(&fds);
+    bool idle_work = false;
 
     for (;;) {
         struct timeval now, waittv, *ptv;
@@ -316,9 +379,15 @@ static noreturn void mainloop(int pfd) {
         }
 
         if (deadline.tv_sec == 0) {
-            if (tqhead == tqtail)
-                ptv = NULL;
-            else {
+            if (tqhead == tqtail) {
+                // Idle until 'atc' updates, so get ahead on routes for
+                // planes which might show up -- but only between polls.
+                if (idle_work) {
+                    set_timeval_from_ms(&waittv, 0);
+                    ptv = &waittv;
+                } else
+                    ptv = NULL;
+            } else {
                 set_timeval_from_ms(&waittv, typing_delay_ms);
                 ptv = &waittv;
             }
@@ -339,6 +408,16 @@ static noreturn void mainloop(int pfd) {
             ptv = &waittv;
         }
 
+        // While the tick's routes are being planned, spend the wait on
+        // planning instead, and then just poll.
+        const bool planned = frame_planning;
+        if (planned) {
+            struct timespec until;
+            plan_frame(ptv ? timespec_after(&until, ptv) : NULL);
+            set_timeval_from_ms(&waittv, 0);
+            ptv = &waittv;
+        }
+
         add_fd(0, &fds, &maxfd);
         add_fd(ptm, &fds, &maxfd);
         add_fd(pfd, &fds, &maxfd);
@@ -354,9 +433,15 @@ static noreturn void mainloop(int pfd) {
         if (rv == 0) {   // timeout
             if (tqhead != tqtail) {
                 write_queued_chars();
+            } else if (planned) {
+                // The wait went to planning; see what's due now.
             } else if (deadline.tv_sec == 0) {
-                fprintf(logff, "Danger: timeout when pended and no chars "
-                               "to type from the queue.\n");
+                if (idle_work)
+                    idle_work = shadow_step() || precompute_step();
+                else {
+                    fprintf(logff, "Danger: timeout when pended and no "
+                                   "chars to type from the queue.\n");
+                }
             } else {
                 deadline.tv_sec = 0;
                 check_update(&deadline, &last_atc);
@@ -366,6 +451,7 @@ static noreturn void mainloop(int pfd) {
         }
         if (FD_ISSET(ptm, &fds)) {
             process_data(ptm, BUFSIZE, &update_display);
+            idle_work = idle_planning || shadow_mode;
             if (delay_ms && deadline.tv_sec == 0) {
                 gettimeofday(&deadline, NULL);
                 deadline.tv_usec += delay_ms * 1000;
@@ -458,10 +544,30 @@ static const struct option ai_opts[] = {
     { .name = "mark", .has_arg = required_argument, .flag = NULL, .val = 'm' },
     { .name = "verbose", .has_arg = no_argument, .flag = NULL, .val = 'v' },
     { .name = "quiet", .has_arg = no_argument, .flag = NULL, .val = 'q' },
+    { .name = "planner", .has_arg = required_argument, .flag = NULL,
+          .val = 'R' },
+    { .name = "cooperative", .has_arg = no_argument, .flag = NULL,
+          .val = 'C' },
+    { .name = "jobs", .has_arg = required_argument, .flag = NULL,
+          .val = 'j' },
+    { .name = "idle-plan", .has_arg = no_argument, .flag = NULL,
+          .val = 'I' },
+    { .name = "funnel", .has_arg = no_argument, .flag = NULL, .val = 'F' },
+    { .name = "shadow", .has_arg = required_argument, .flag = NULL,
+          .val = 'A' },
+    { .name = "shadow-file", .has_arg = required_argument, .flag = NULL,
+          .val = 'O' },
+    { .name = "trace", .has_arg = required_argument, .flag = NULL,
+          .val = 'X' },
+    { .name = "heuristics", .has_arg = required_argument, .flag = NULL,
+          .val = 'H' },
+    { .name = "tune", .has_arg = required_argument, .flag = NULL,
+          .val = 'U' },
+    { .name = "bench", .has_arg = no_argument, .flag = NULL, .val = 'B' },
     { .name = NULL, .has_arg = 0, .flag = NULL, .val = '\0' }
 };
 
-static const char optstring[] = ":hd:t:sSTL:a:g:r:i:D:f:P:m:vq";
+static const char optstring[] = ":hd:t:sSTBL:a:g:r:i:D:f:P:m:vqR:Cj:IFA:O:X:H:U:";
 
 static const char usage[] =
     "Usage:  atc-ai [<ai-args>] [-- <atc-args>]\n"
@@ -480,6 +586,13 @@ static const char usage[] =
     "            After moving, wait for 'atc' to advance.\n"
     "        -T|--self-test\n"
     "            Run a self-test.\n"
+    "        -B|--bench\n"
+    "            Time the planner:  Its move kernels against its generic\n"
+    "            moves, short routes by greedy and A* search, landings by\n"
+    "            greedy and bidirectional search, long crossings by greedy\n"
+    "            and hierarchical search, caged searches with and without\n"
+    "            dominance pruning, and portfolio races on the crossings\n"
+    "            and landings.\n"
     "        -L|--logfile <filename>\n"
     "            Log to write to.  (default \"" DEF_LOGFILE "\")\n"
     "        -f|--frames <frame number>\n"
@@ -507,23 +620,82 @@ static const char usage[] =
     "            Increase the verbosity in the log file.\n"
     "        -q|--quiet\n"
     "            Decrease the verbosity in the log file.\n"
+    "        -R|--planner greedy|astar[:<weight>]|bidir|hier|portfolio\n"
+    "            Route planner to use:  Greedy search with backtracking,\n"
+    "            (weighted) A*, greedy search meeting a tree grown back\n"
+    "            from each landing, greedy search kept to a route\n"
+    "            planned first on a coarse grid, or a race of all of\n"
+    "            them and some other weights on the worker threads.\n"
+    "            (default greedy, weight 1)\n"
+    "        -C|--cooperative\n"
+    "            Replan planes headed for the same exit or airport together\n"
+    "            when a new one's route comes out too long.\n"
+    "        -j|--jobs <threads>\n"
+    "            Plan the courses of planes appearing together on this\n"
+    "            many threads.  (default 1)\n"
+    "        -I|--idle-plan\n"
+    "            While waiting for 'atc', plan routes for planes which\n"
+    "            might appear next tick.\n"
+    "        -F|--funnel\n"
+    "            Fly a plane bound for an airport in down the airport's\n"
+    "            landing funnel once it reaches it, rather than searching\n"
+    "            the rest of the way.\n"
+    "        -A|--shadow greedy|astar|bidir|hier|portfolio\n"
+    "            While waiting for 'atc', also route each new plane with\n"
+    "            this planner and with -R's, on a copy, and compare them\n"
+    "            in the shadow stats file.  Nothing it plans is flown.\n"
+    "        -O|--shadow-file <file>\n"
+    "            Shadow stats file.  (default atc-ai.shadow)\n"
+    "        -X|--trace <plane>[:<tick>[-<tick>][:<row>,<col>[-<row>,<col>]]]\n"
+    "            Trace the planning for this plane ('*' for any), at these\n"
+    "            ticks ('*' for any), from these squares, in the log.\n"
+    "        -H|--heuristics <name>=<value>[,<name>=<value>...]\n"
+    "            Weights for the greedy search:  matchcourse, changealt,\n"
+    "            aligned_div, minor_div, exit_mult, detour, corridor,\n"
+    "            and block_load.\n"
+    "        -U|--tune <corpus file>\n"
+    "            Tune the greedy search's weights over the games listed\n"
+    "            as \"<seed> <board>\" lines in the file, each played for\n"
+    "            \"-f\" frames (default " STR(DEF_TUNE_FRAMES) "), \"-j\" at a\n"
+    "            time (default one per CPU), and print the best.\n"
     "\n"
     "atc-ai was written by Jacob L. Mandelson, and may be distributed in\n"
     "accordance with the Affero General Public License v. 3.\n";
 
 
-static bool do_self_test = false;
+static bool do_self_test = false, do_bench = false;
 static bool print_usage_message = false;
 static intmax_t random_seed = -2;
 static bool do_skip = false, dont_skip = false;
+static int jobs = 0;
+static const char *tune_corpus = NULL;
 bool verbose = false, quiet = false;
 
+// Set '*kind' to the planner called 'name'.  Returns false if there's
+// none by that name.
+static bool planner_of(const char *name, enum planner_kind *kind) {
+    if (!strcmp(name, "greedy"))
+        *kind = PLANNER_GREEDY;
+    else if (!strcmp(name, "astar"))
+        *kind = PLANNER_ASTAR;
+    else if (!strcmp(name, "bidir"))
+        *kind = PLANNER_BIDIR;
+    else if (!strcmp(name, "hier"))
+        *kind = PLANNER_HIER;
+    else if (!strcmp(name, "portfolio"))
+        *kind = PLANNER_PORTFOLIO;
+    else
+        return false;
+    return true;
+}
+
 static void process_cmd_args(int argc, char *const argv[]) {
     int arg;
     for (;;) {
         arg = getopt_long(argc, argv, optstring, ai_opts, NULL);
         switch (arg) {
             const char *istr;
+            char *weight;
             case -1:
                 return;
             case ':': case '?': case 'h': default:
@@ -544,6 +716,9 @@ static void process_cmd_args(int argc, char *const argv[]) {
             case 'T':
                 do_self_test = true;
                 break;
+            case 'B':
+                do_bench = true;
+                break;
             case 'L':
                 logfile_name = optarg;
                 break;
@@ -603,6 +778,52 @@ static void process_cmd_args(int argc, char *const argv[]) {
             case 'q':
                 quiet = true;
                 break;
+            case 'R':
+                // Only A* takes a weight.
+                weight = strchr(optarg, ':');
+                if (weight)
+                    *weight++ = '\0';
+                if (!planner_of(optarg, &planner)) {
+                    print_usage_message = true;
+                } else if (weight) {
+                    astar_weight = atof(weight);
+                    if (planner != PLANNER_ASTAR || astar_weight < 1)
+                        print_usage_message = true;
+                }
+                break;
+            case 'C':
+                coop_replan = true;
+                break;
+            case 'j':
+                jobs = atoi(optarg);
+                if (jobs < 1)
+                    print_usage_message = true;
+                break;
+            case 'I':
+                idle_planning = true;
+                break;
+            case 'F':
+                fly_funnels = true;
+                break;
+            case 'A':
+                shadow_mode = planner_of(optarg, &shadow_planner);
+                if (!shadow_mode)
+                    print_usage_message = true;
+                break;
+            case 'O':
+                shadow_file_name = optarg;
+                break;
+            case 'X':
+                if (!set_trace(optarg))
+                    print_usage_message = true;
+                break;
+            case 'H':
+                if (!set_heuristics(optarg))
+                    print_usage_message = true;
+                break;
+            case 'U':
+                tune_corpus = optarg;
+                break;
         }
     }
 }
@@ -647,6 +868,17 @@ int main(int argc, char **argv) {
         return testmain();
     }
 
+    if (do_bench) {
+        return benchmain();
+    }
+
+    if (tune_corpus) {
+        return tune(tune_corpus, "/proc/self/exe", atc_cmd, jobs,
+                    duration_frame > 0 ? duration_frame : DEF_TUNE_FRAMES);
+    }
+
+    workers_init(jobs ? jobs : 1);
+
     int v = pipe(pipefd); v=v;
     sigpipe = pipefd[1];
     ptm = get_ptm();
@@ -3,9 +3,12 @@
 // Public License, ver. 3.  See the file "AGPLv3" for details.
 
 #include <string.h>
-#include <stdarg.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <ctype.h>
 #include <assert.h>
+#include <time.h>
+#include <pthread.h>
 #include "atc-ai.h"
 #include "pathfind.h"
 
@@ -23,15 +26,30 @@ const struct bearing bearings__[9] = {
 };
 const struct bearing *const bearings = bearings__ + 1;
 
+// The bearings' steps again, as constants the planner's kernels can fold.
+static const signed char bearing_drow[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+static const signed char bearing_dcol[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
 
-static void free_op_courses(struct op_courses *oc);
+static inline struct xy step_to(int row, int col, int bearing) {
+    struct xy rv = { row + bearing_drow[bearing], col + bearing_dcol[bearing] };
+    return rv;
+}
 
-static inline int sgn(int x) {
-    if (x > 0)
-        return 1;
-    if (x < 0)
-        return -1;
-    return 0;
+__thread struct arena search_arena;
+
+// Each plane's course is an array, grown by doubling, so planning and
+// backtracking mostly just move its length.  'n_courses' counts the
+// entries allocated for all of them; the worker threads share it, so it
+// has a lock.
+#define COURSE_MIN 32
+static pthread_mutex_t count_lock = PTHREAD_MUTEX_INITIALIZER;
+int n_courses, n_courses_hiwater;
+
+// Guards the planners' record keeping.
+pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline int imax(int a, int b) {
+    return a > b ? a : b;
 }
 
 int bearing_of(const char *s) {
@@ -42,15 +60,6 @@ int bearing_of(const char *s) {
     return -1;
 }
 
-static bool is_exit_at(int row, int col) {
-    for (int i = 0; i < n_exits; i++) {
-        if (exits[i].row == row && exits[i].col == col)
-            return true;
-    }
-
-    return false;
-}
-
 static int calc_bearing(int row, int col) {
     if ((row == 0 && col == 0) || (row == 1 && col == 1))
         return bearing_of("SE");
@@ -87,26 +96,60 @@ static int calc_bearing(int row, int col) {
     return -1;
 }
 
-static void add_course_elem(struct plane *p, int row, int col, int alt,
-                            int bearing, bool cleared_exit, int trace_tick) {
+static void count_courses(int n) {
+    pthread_mutex_lock(&count_lock);
+    n_courses += n;
+    if (n_courses > n_courses_hiwater)
+        n_courses_hiwater = n_courses;
+    pthread_mutex_unlock(&count_lock);
+}
+
+// Make room in 'p's course for 'n' more entries.
+static void grow_course(struct plane *p, int n) {
+    if (p->len + n <= p->cap)
+        return;
+    int cap = p->cap ? p->cap : COURSE_MIN;
+    while (cap < p->len + n)
+        cap *= 2;
+    struct course *c = malloc(cap * sizeof(*c));
+    if (c == NULL)
+        errexit('m', "Out of memory allocating course entries.");
+    if (p->course) {
+        memcpy(c, p->course, p->len * sizeof(*c));
+        free(p->course);
+    }
+    count_courses(cap - p->cap);
+    p->course = c;
+    p->cap = cap;
+}
+
+void free_course(struct plane *p) {
+    if (p->course)
+        free(p->course);
+    count_courses(-p->cap);
+    p->course = NULL;
+    p->len = p->cap = 0;
+}
+
+void add_course_elem(struct plane *p, int row, int col, int alt,
+                     int bearing, bool cleared_exit, int trace_tick) {
     if (trace_tick) {
         fprintf(logff, "\t%d: (%d, %d, %d)@%d\n", trace_tick, row, col, alt,
                 bearings[bearing].degree);
     }
-    struct course *nc = malloc(sizeof(*nc));
+    grow_course(p, 1);
+    struct course *nc = &p->course[p->len++];
     nc->pos.row = row;  nc->pos.col = col;  nc->pos.alt = alt;
     nc->bearing = bearing;
     nc->cleared_exit = cleared_exit;
     nc->at_exit = false;
-    if (!p->start)
-        p->start = nc;
-    nc->prev = p->end;
-    nc->next = NULL;
-    p->end = nc;
-    if (nc->prev) {
-        assert(nc->prev->next == NULL);
-        nc->prev->next = nc;
-    }
+}
+
+// Add 'n' entries, from 'c', to the end of 'p's course.
+void append_course(struct plane *p, const struct course *c, int n) {
+    grow_course(p, n);
+    memcpy(&p->course[p->len], c, n * sizeof(*c));
+    p->len += n;
 }
 
 static int distcmp(const void *b, const void *a) {
@@ -125,27 +168,15 @@ static int edist(int r1, int c1, int a1, int r2, int c2, int a2) {
     return dr*dr + dc*dc + da*da;
 }
 
-static bool in_airport_excl(struct xy rc, int alt, int airport_num) {
-    struct airport *a = get_airport(airport_num);
-
-    if (alt >= 3)
-        return false;
-
-    for (int i = 0; i < EZ_SIZE; i++) {
-        if (a->exc[i].row == rc.row && a->exc[i].col == rc.col)
-            return true;
-    }
-
-    if (bearings[a->bearing].dcol)
-        return sgn(rc.col - a->col) == bearings[a->bearing].dcol;
-    else
-        return sgn(rc.row - a->row) == bearings[a->bearing].drow;
+static inline bool in_airport_excl(struct xy rc, int alt, int airport_num) {
+    return alt < 3 && (cells[rc.row][rc.col].excl & 1u << airport_num);
 }
 
-static int cdist(int r, int c, int alt, struct xyz target,
-                 const struct plane *p, int srow, int scol) {
+static inline int cdist(int r, int c, int alt, struct xyz target,
+                        const struct plane *p, bool to_airport,
+                        int srow, int scol) {
     struct xy sxy = { .row = srow, .col = scol };
-    if (p->target_airport && in_airport_excl(sxy, 1, p->target_num)) {
+    if (to_airport && in_airport_excl(sxy, 1, p->target_num)) {
         // Use an airport's secondary targets.
         const struct airport *ap = get_airport(p->target_num);
         int dist1 = edist(r, c, alt, ap->strow1, ap->stcol1, 2);
@@ -156,59 +187,93 @@ static int cdist(int r, int c, int alt, struct xyz target,
     return edist(r, c, alt, target.row, target.col, target.alt);
 }
 
-static bool pos_adjacent(struct xyz pos, struct xy rc, int alt) {
-    if (pos.alt == 0)
-        return false;
-
-    return abs(pos.row - rc.row) < 2 && abs(pos.col - rc.col) < 2 &&
-           abs(pos.alt - alt) < 2;
-}
-
-struct blp { int bearing, alt; bool isjet; };
+// The greedy search's weights, which can be set with "-H" and tuned with
+// "--tune".
+struct heuristics heur = {
+    .matchcourse_penalty = 1000,
+    .changealt_bonus = 100,
+    .aligned_div = 2,
+    .minor_match_div = 10,
+    .exit_mult = 10,
+    .detour_weight = 2,
+    .corridor_penalty = 100,
+    .block_load_weight = 2,
+};
 
-static struct blp adjacent_another_plane(struct xy rc, int alt, bool imjet,
-                                         const struct op_courses *opc) {
-    for ( ; opc; opc = opc->next) {
-        if (!opc->c || opc->c->at_exit)
-            continue;
-        struct xyz pos = opc->c->pos;
-        if (pos_adjacent(pos, rc, alt)) {
-            struct blp rv = { opc->c->bearing, pos.alt, opc->isjet };
-            return rv;
-        }
-        if (!imjet && opc->c->next) {
-            pos = opc->c->next->pos;
-            if (pos_adjacent(pos, rc, alt)) {
-                struct blp rv = { opc->c->next->bearing, pos.alt, opc->isjet };
-                return rv;
-            }
+const struct heur_param heur_params[] = {
+    { "matchcourse", &heur.matchcourse_penalty, 0 },
+    { "changealt", &heur.changealt_bonus, 0 },
+    { "aligned_div", &heur.aligned_div, 1 },
+    { "minor_div", &heur.minor_match_div, 1 },
+    { "exit_mult", &heur.exit_mult, 0 },
+    { "detour", &heur.detour_weight, 0 },
+    { "corridor", &heur.corridor_penalty, 0 },
+    { "block_load", &heur.block_load_weight, 0 },
+};
+const int n_heur_params = sizeof(heur_params) / sizeof(*heur_params);
+
+// The weights the searches on this thread go by:  "-H"'s, unless the
+// portfolio planner has it running a strategy of its own.
+__thread const struct heuristics *search_heur = &heur;
+
+// Set while the portfolio planner has this thread running a strategy:
+// The flag which calls the search off once another strategy has won.
+__thread const volatile bool *search_cancel;
+
+// Set the weights from 'spec', of the form <name>=<value>[,...].  Returns
+// false if 'spec' doesn't parse, having set those which came before.
+bool set_heuristics(const char *spec) {
+    while (*spec) {
+        const char *eq = strchr(spec, '=');
+        if (eq == NULL)
+            return false;
+        const struct heur_param *hp = NULL;
+        for (int i = 0; i < n_heur_params; i++) {
+            if (strlen(heur_params[i].name) == (size_t) (eq - spec) &&
+                    !strncmp(heur_params[i].name, spec, eq - spec))
+                hp = &heur_params[i];
         }
+        int value, n;
+        if (hp == NULL || sscanf(eq+1, "%d%n", &value, &n) != 1 ||
+                value < hp->min)
+            return false;
+        *hp->value = value;
+        spec = eq+1 + n;
+        if (*spec == ',')
+            spec++;
+        else if (*spec)
+            return false;
     }
-
-    struct blp rv = { -1, -1, true };
-    return rv;
+    return true;
 }
 
-// Also have a penalty for a jet aligning with a prop at the
-// same FL and orthodistance 2, because that's essentially
-// "matching" up courses (to be tighter with this check,
-// we should check bearings).
-// FIXME: self-test this
-static bool planes_aligned(struct xy rc, int alt, bool imjet,
-                           const struct op_courses *opc) {
-    if (!imjet)
-        return false;
-    for ( ; opc; opc = opc->next) {
-        if (!opc->c || opc->c->at_exit || opc->isjet)
-            continue;
-        struct xyz pos = opc->c->pos;
-        int dr = rc.row - pos.row;
-        int dc = rc.col - pos.col;
-        if (alt == pos.alt && ((dr == 0 && abs(dc) == 2) ||
-                               (dc == 0 && abs(dr) == 2)))
-            return true;
+// Write the weights to 'buf' in the form set_heuristics() takes.
+void format_heuristics(char *buf, size_t size) {
+    int used = 0;
+    buf[0] = '\0';
+    for (int i = 0; i < n_heur_params && used < (int) size; i++) {
+        used += snprintf(buf + used, size - used, "%s%s=%d", i ? "," : "",
+                         heur_params[i].name, *heur_params[i].value);
     }
-    return false;
+}
+
+// How much further than the straight-line distance the cost-to-go table
+// puts the target, in cdist()'s squared units:  The plane has to go the
+// long way around a wall or turn around first.  -1 if the target can't be
+// reached at all, 0 if there's no table for it.
+static int detour(const struct plane *p, int row, int col, int alt,
+                  int bearing, bool cleared_exit, struct xyz target) {
+    int ctg = cost_to_go(p, row, col, alt, bearing, cleared_exit);
+    if (ctg < 0)
+        return 0;
+    if (ctg == CTG_INF)
+        return -1;
+    int cheb = abs(row - target.row);
+    if (abs(col - target.col) > cheb)
+        cheb = abs(col - target.col);
+    if (abs(alt - target.alt) > cheb)
+        cheb = abs(alt - target.alt);
+    return search_heur->detour_weight * (ctg*ctg - cheb*cheb);
 }
 
 static void new_cand(struct frame *frame, int bearing, int alt, int dist) {
@@ -218,8 +283,6 @@ static void new_cand(struct frame *frame, int bearing, int alt, int dist) {
     frame->cand[i].distance = dist;
 }
 
-#define MATCHCOURSE_PENALTY 1000
-#define CHANGEALT_BONUS 100
 #define BLP_MAX 10
 
 static void add_blocking_plane(struct blp *blocking_planes, int *n_blp,
@@ -236,19 +299,117 @@ static void add_blocking_plane(struct blp *blocking_planes, int *n_blp,
         blocking_planes[(*n_blp)++] = adjacent_plane;
 }
 
-__attribute__((format(printf, 2, 3) ))
-static inline void tracelog(const bool trace, const char *fmt, ...) {
-    if (trace) {
-        va_list va;
-        va_start(va, fmt);
-        vfprintf(logff, fmt, va);
-        va_end(va);
+static inline bool on_board(struct xy rc) {
+    return rc.row >= 0 && rc.col >= 0 &&
+           rc.row < board_height && rc.col < board_width;
+}
+
+// The rules for a move from (srow, scol, alt) to (rc, nalt) which don't
+// depend on the other planes, save for staying out of the exits.  'rc'
+// must be on the board.  'to_airport' is p->target_airport, passed apart
+// so the kernels can make it a constant.
+static inline enum move_kind board_rules(const struct plane *p,
+                                         int srow, int scol, int alt,
+                                         struct xy rc, int nalt,
+                                         struct xyz target,
+                                         bool cleared_exit, bool to_airport) {
+    if (nalt <= 0 || nalt >= 10)
+        return MOVE_ILLEGAL;
+    if (target.alt == 9 && nalt == 9 &&
+            rc.row == target.row && rc.col == target.col) {
+        // Reached the proper exit gate.  Can't collide here,
+        // planes just immediately disappear.
+        return MOVE_EXIT;
     }
+    const struct cell *cell = &cells[rc.row][rc.col];
+    if (cell->flags & CELL_BOUNDARY)    // ... and not at the target exit
+        return MOVE_ILLEGAL;
+    if (cleared_exit && to_airport &&
+            in_airport_excl(rc, nalt, p->target_num))
+        return MOVE_ILLEGAL;
+    if (nalt == 1 && to_airport &&
+            rc.row == target.row && rc.col == target.col &&
+            in_airport_excl(apply(srow, scol, -1), alt, p->target_num))
+        return MOVE_ILLEGAL;
+    return MOVE_OK;
 }
 
-void calc_next_move(const struct plane *p, const int srow, const int scol,
-                    int *alt, const struct xyz target, int *bearing,
-                    const bool cleared_exit, struct frame *frame) {
+// The penalty for being at (rc, nalt) in an exit's corridor, at an
+// altitude where new planes might appear next to it.
+static inline int corridor_cost(struct xy rc, int nalt) {
+    return nalt >= 6 && nalt <= 8 &&
+           (cells[rc.row][rc.col].flags & CELL_CORRIDOR) ?
+           search_heur->corridor_penalty : 0;
+}
+
+// Keep out of where planes appear once we've left our own exit behind.
+static inline bool near_exit_band(struct xy rc, int nalt, bool cleared_exit,
+                                  bool to_airport) {
+    return cleared_exit && (cells[rc.row][rc.col].flags & CELL_EDGE_BAND) &&
+           ((to_airport && nalt >= 6) || (!to_airport && nalt != 9));
+}
+
+// The board rules, and the arrival slots:  Only one plane may arrive at a
+// target on a tick.
+static inline enum move_kind own_rules(const struct plane *p,
+                                       int srow, int scol, int alt,
+                                       struct xy rc, int nalt,
+                                       struct xyz target, bool cleared_exit,
+                                       bool to_airport, int tick) {
+    enum move_kind mk = board_rules(p, srow, scol, alt, rc, nalt, target,
+                                    cleared_exit, to_airport);
+    if (mk == MOVE_ILLEGAL)
+        return mk;
+    if (rc.row == target.row && rc.col == target.col && nalt == target.alt &&
+            !slot_free(p, tick))
+        return MOVE_ILLEGAL;
+    return mk;
+}
+
+// Classify a move from (srow, scol, alt) to (rc, nalt) arriving at 'tick'.
+// If another plane is in the way, it's put in '*blocker'.
+inline enum move_kind check_move(const struct plane *p, int srow, int scol,
+                                 int alt, struct xy rc, int nalt,
+                                 struct xyz target, bool cleared_exit,
+                                 int tick, struct blp *blocker) {
+    if (!on_board(rc))
+        return MOVE_ILLEGAL;
+    enum move_kind mk = own_rules(p, srow, scol, alt, rc, nalt, target,
+                                  cleared_exit, p->target_airport, tick);
+    if (mk != MOVE_OK)
+        return mk;
+
+    *blocker = resv_adjacent(rc, nalt, p->isjet, tick);
+    if (blocker->alt > 0)
+        return MOVE_BLOCKED;
+
+    if (near_exit_band(rc, nalt, cleared_exit, p->target_airport))
+        return MOVE_ILLEGAL;
+
+    return MOVE_OK;
+}
+
+// As check_move(), but ignoring the other planes.
+enum move_kind check_static_move(const struct plane *p, int srow, int scol,
+                                 int alt, struct xy rc, int nalt,
+                                 struct xyz target, bool cleared_exit) {
+    if (!on_board(rc))
+        return MOVE_ILLEGAL;
+    enum move_kind mk = board_rules(p, srow, scol, alt, rc, nalt, target,
+                                    cleared_exit, p->target_airport);
+    if (mk == MOVE_OK &&
+            near_exit_band(rc, nalt, cleared_exit, p->target_airport))
+        return MOVE_ILLEGAL;
+    return mk;
+}
+
+// The body of calc_next_move() and its kernels, with p->isjet and
+// p->target_airport as 'isjet' and 'to_airport'.
+static inline __attribute__((always_inline))
+void next_move(const struct plane *p, const int srow, const int scol,
+               int *alt, const struct xyz target, int *bearing,
+               const bool cleared_exit, const struct traffic_view *view,
+               struct frame *frame, const bool isjet, const bool to_airport) {
     // Avoid obstacles.  Obstacles are:  The boundary except for the
     // target exit at alt==9, adjacency with another plane (props have
     // to check this at t+1 and t+2), within 2 of an exit at alt 6-8 if
@@ -260,17 +421,19 @@ void calc_next_move(const struct plane *p, const int srow, const int scol,
     int n_blp = 0;
 
     int nalt;
+    const int tick = view_tick(view, frame->depth);
+    const struct heuristics *const w = search_heur;
 
-    const bool trace = (p->id == 'j' && srow == 1 && scol == 9 && *alt == 9 &&
-                  bearings[*bearing].aircode == '<' &&
-                  target.row == 0 && target.col == 29 && target.alt == 9);
+    const bool trace = tracing(p, srow, scol, tick);
+    // Only from an exit can a move go off the board.
+    const bool from_edge = cells[srow][scol].flags & CELL_BOUNDARY;
 
     // If the plane's at the airport, it can only hold or take off.
     if (*alt == 0) {
-        struct xy rc = apply(srow, scol, *bearing);
+        struct xy rc = step_to(srow, scol, *bearing);
         frame->cand[0].bearing = frame->cand[1].bearing = *bearing;
         frame->cand[0].alt = 0;  frame->cand[1].alt = 1;
-        if (adjacent_another_plane(rc, 1, p->isjet, frame->opc_start).alt > 0) {
+        if (resv_adjacent(rc, 1, isjet, tick).alt > 0) {
             // Can't take off, can only hold.
             frame->n_cand = 1;
         } else {
@@ -280,108 +443,129 @@ void calc_next_move(const struct plane *p, const int srow, const int scol,
         return;
     }
 
+    // Check the moves against the other planes' courses all at once, a
+    // lane for each turn and altitude change.
+    struct cand_batch cb;
+    for (int turn = -2; turn <= 2; turn++) {
+        struct xy rc = step_to(srow, scol, (*bearing + turn) & 7);
+        for (int da = -1; da <= 1; da++) {
+            int i = (turn+2)*3 + da+1;
+            cb.row[i] = rc.row;  cb.col[i] = rc.col;  cb.alt[i] = *alt + da;
+        }
+    }
+    struct move_checks mc;
+    resv_check_moves(&cb, 15, (struct xy) { srow, scol }, *alt, isjet,
+                     tick, &mc);
+
     frame->n_cand = 0;
     for (int turn = -2; turn <= 2; turn++) {
         int nb = (*bearing + turn) & 7;
-        struct xy rc = apply(srow, scol, nb);
-        if (rc.row < 0 || rc.col < 0 ||
-                rc.row >= board_height || rc.col >= board_width)
-            continue;
-        bool on_boundary = (rc.row == 0 || rc.row == board_height-1 ||
-                            rc.col == 0 || rc.col == board_width-1);
+        struct xy rc = step_to(srow, scol, nb);
         for (nalt = *alt-1; nalt <= *alt+1; nalt++) {
-            if (nalt == 0 || nalt == 10)
+            const int lane = (turn+2)*3 + nalt - *alt + 1;
+            if (from_edge && !on_board(rc))
+                break;
+            enum move_kind mk = own_rules(p, srow, scol, *alt, rc, nalt,
+                                          target, cleared_exit, to_airport,
+                                          tick);
+            if (mk == MOVE_ILLEGAL)
                 continue;
-            if (target.alt == 9 && nalt == 9 &&
-                    rc.row == target.row && rc.col == target.col) {
-                // Reached the proper exit gate.  Can't collide here,
-                // planes just immediately disappear.
-                new_cand(frame, nb, nalt, -10*MATCHCOURSE_PENALTY);
+            if (mk == MOVE_EXIT) {
+                new_cand(frame, nb, nalt,
+                         -w->exit_mult * w->matchcourse_penalty);
                 break;
             }
-            if (on_boundary)    // ... and not at the target exit
-                continue;
-            if (cleared_exit && p->target_airport &&
-                    in_airport_excl(rc, nalt, p->target_num))
-                continue;
-            if (nalt == 1 && p->target_airport &&
-                    rc.row == target.row && rc.col == target.col &&
-                    in_airport_excl(apply(srow, scol, -1), *alt, p->target_num))
-                continue;
-            struct blp adjacent_plane =
-                adjacent_another_plane(rc, nalt, p->isjet, frame->opc_start);
-
-            if (adjacent_plane.alt > 0) {
+            if (mc.blocked & 1u << lane) {
+                struct blp adjacent_plane = mc.blocker[lane];
                 add_blocking_plane(blocking_planes, &n_blp, adjacent_plane);
-                tracelog(trace, "Candidate move to (%d, %d, %d) bearing %s "
-                                "blocked by %s plane at altitude %d "
-                                "bearing %s\n",
-                         rc.row, rc.col, nalt, bearings[nb].shortname,
-                         adjacent_plane.isjet ? "jet" : "prop",
-                         adjacent_plane.alt,
-                         bearings[adjacent_plane.bearing].shortname);
+                TRACE(trace, "Candidate move to (%d, %d, %d) bearing %s "
+                             "blocked by %s plane at altitude %d "
+                             "bearing %s\n",
+                      rc.row, rc.col, nalt, bearings[nb].shortname,
+                      adjacent_plane.isjet ? "jet" : "prop",
+                      adjacent_plane.alt,
+                      bearings[adjacent_plane.bearing].shortname);
                 continue;
             }
-            if (cleared_exit && (rc.row <= 2 || rc.row >= board_height - 3 ||
-                                 rc.col <= 2 || rc.col >= board_width - 3) &&
-                    ((p->target_airport && nalt >= 6) ||
-                     (!p->target_airport && nalt != 9)))
+            if (near_exit_band(rc, nalt, cleared_exit, to_airport))
+                continue;
+            int extra = detour(p, rc.row, rc.col, nalt, nb,
+                               cleared_exit || clears_exit(rc.row, rc.col,
+                                                           nalt),
+                               target);
+            if (extra < 0) {
+                TRACE(trace, "Candidate move to (%d, %d, %d) bearing %s "
+                             "is a dead end.\n",
+                      rc.row, rc.col, nalt, bearings[nb].shortname);
                 continue;
-            bool aligned = planes_aligned(rc, nalt, p->isjet, frame->opc_start);
-            int penalty = aligned ? MATCHCOURSE_PENALTY/2 : 0;
-            int distance = penalty + cdist(rc.row, rc.col, nalt, target, p,
-                                           srow, scol);
+            }
+            // Also have a penalty for a jet aligning with a prop at the
+            // same FL and orthodistance 2, because that's essentially
+            // "matching" up courses (to be tighter with this check,
+            // we should check bearings).
+            bool aligned = mc.aligned & 1u << lane;
+            int penalty = aligned ?
+                          w->matchcourse_penalty / w->aligned_div : 0;
+            penalty += corridor_cost(rc, nalt);
+            int distance = penalty + extra + cdist(rc.row, rc.col, nalt,
+                                                   target, p, to_airport,
+                                                   srow, scol);
             new_cand(frame, nb, nalt, distance);
-            tracelog(trace, "Adding candidate move to (%d, %d, %d) bearing %s "
-                            "distance=%d\n", rc.row, rc.col, nalt,
-                     bearings[nb].longname, distance);
+            TRACE(trace, "Adding candidate move to (%d, %d, %d) bearing %s "
+                         "distance=%d\n", rc.row, rc.col, nalt,
+                  bearings[nb].longname, distance);
         }
     }
     assert(frame->n_cand <= 15);
     if (frame->n_cand == 0) {
-        tracelog(trace, "Warning: Can't find safe path for plane '%c'\n",
-                 p->id);
+        TRACE(trace, "Warning: Can't find safe path for plane '%c'\n",
+              p->id);
         *alt = -1;
         return;
     }
-    tracelog(trace, "Checking %d candidate moves against %d blocking planes.\n",
-             frame->n_cand, n_blp);
+    TRACE(trace, "Checking %d candidate moves against %d blocking planes.\n",
+          frame->n_cand, n_blp);
     for (int i = 0; i < frame->n_cand; i++) {
         for (int j = 0; j < n_blp; j++) {
              if (frame->cand[i].bearing != blocking_planes[j].bearing ||
-                    p->isjet != blocking_planes[j].isjet) {
-                tracelog(trace, "Not applying matchcourse penalty: "
-                                "%s c_bearing %s vs. %s b_bearing %s "
-                                "(%d/%d vs. %d/%d)\n",
-                         p->isjet ? "jet" : "prop",
-                         bearings[frame->cand[i].bearing].shortname,
-                         blocking_planes[j].isjet ? "jet" : "prop",
-                         bearings[blocking_planes[j].bearing].shortname,
-                         frame->cand[i].bearing, p->isjet,
-                         blocking_planes[j].bearing, blocking_planes[j].isjet);
+                    isjet != blocking_planes[j].isjet) {
+                TRACE(trace, "Not applying matchcourse penalty: "
+                             "%s c_bearing %s vs. %s b_bearing %s "
+                             "(%d/%d vs. %d/%d)\n",
+                      isjet ? "jet" : "prop",
+                      bearings[frame->cand[i].bearing].shortname,
+                      blocking_planes[j].isjet ? "jet" : "prop",
+                      bearings[blocking_planes[j].bearing].shortname,
+                      frame->cand[i].bearing, isjet,
+                      blocking_planes[j].bearing, blocking_planes[j].isjet);
                 continue;
              }
              int da = abs(frame->cand[i].alt - blocking_planes[j].alt);
              if (da == 0) {
-                tracelog(trace, "Applying matchcourse penalty to plane %c "
-                                "bearing %s.\n",
-                         p->id, bearings[blocking_planes[j].bearing].longname);
-                frame->cand[i].distance += MATCHCOURSE_PENALTY;
+                TRACE(trace, "Applying matchcourse penalty to plane %c "
+                             "bearing %s.\n",
+                      p->id, bearings[blocking_planes[j].bearing].longname);
+                frame->cand[i].distance += w->matchcourse_penalty;
              } else if (da == 1) {
-                tracelog(trace, "Applying minor matchcourse penalty to "
-                                "plane %c bearing %s.\n",
-                         p->id, bearings[blocking_planes[j].bearing].longname);
-                frame->cand[i].distance += MATCHCOURSE_PENALTY/10;
+                TRACE(trace, "Applying minor matchcourse penalty to "
+                             "plane %c bearing %s.\n",
+                      p->id, bearings[blocking_planes[j].bearing].longname);
+                frame->cand[i].distance += w->matchcourse_penalty /
+                                           w->minor_match_div;
              } else {
-                tracelog(trace, "Not applying matchcourse penalty: "
-                                "c_alt %d vs. b_alt %d\n",
-                         frame->cand[i].alt, blocking_planes[j].alt);
+                TRACE(trace, "Not applying matchcourse penalty: "
+                             "c_alt %d vs. b_alt %d\n",
+                      frame->cand[i].alt, blocking_planes[j].alt);
              }
         }
     }
     qsort(frame->cand, frame->n_cand, sizeof(*frame->cand), distcmp);
 
-    int old_dist = cdist(srow, scol, *alt, target, p, srow, scol);
+    int old_dist = cdist(srow, scol, *alt, target, p, to_airport, srow,
+                         scol);
+    int extra = detour(p, srow, scol, *alt, *bearing, cleared_exit, target);
+    if (extra > 0)
+        old_dist += extra;
     if (frame->cand[frame->n_cand-1].distance > old_dist) {
         // We're being pushed away from the destination.  Apply the
         // alt change bonus and re-sort.
@@ -389,7 +573,7 @@ void calc_next_move(const struct plane *p, const int srow, const int scol,
             for (int j = 0; j < n_blp; j++) {
                 if (*alt == blocking_planes[j].alt &&
                         frame->cand[i].alt != blocking_planes[j].alt)
-                    frame->cand[i].distance -= CHANGEALT_BONUS;
+                    frame->cand[i].distance -= w->changealt_bonus;
             }
         }
         qsort(frame->cand, frame->n_cand, sizeof(*frame->cand), distcmp);
@@ -399,100 +583,71 @@ void calc_next_move(const struct plane *p, const int srow, const int scol,
     *alt = frame->cand[frame->n_cand-1].alt;
 }
 
-static void new_op_course(const struct course *c,
-                          struct op_courses **st,
-                          struct op_courses **end,
-                          bool isjet) {
-    struct op_courses *ne = malloc(sizeof(*ne));
-    ne->c = c;
-    ne->isjet = isjet;
-    ne->prev = *end;
-    ne->next = NULL;
-    if (*end)
-        (**end).next = ne;
-    else
-        *st = ne;
-    *end = ne;
-}
-
-static struct op_courses *next_opc(const struct op_courses *o) {
-    struct op_courses *st = NULL, *end = NULL;
-    while (o) {
-        new_op_course(o->c ? o->c->next : NULL, &st, &end, o->isjet);
-        o = o->next;
-    }
-    return st;
+// The generic move, testing the plane's type and kind of target as it goes.
+void calc_next_move(const struct plane *p, const int srow, const int scol,
+                    int *alt, const struct xyz target, int *bearing,
+                    const bool cleared_exit, const struct traffic_view *view,
+                    struct frame *frame) {
+    next_move(p, srow, scol, alt, target, bearing, cleared_exit, view, frame,
+              p->isjet, p->target_airport);
 }
 
-static void incr_opc(struct op_courses *st) {
-    for (struct op_courses *o = st; o; o = o->next) {
-        if (o->c)
-            o->c = o->c->next;
+// calc_next_move() specialized for each type of plane and kind of target,
+// so the tests on them fold away.  The search picks one per route with
+// move_kernel_for().
+#define MOVE_KERNEL(name, isjet, to_airport)                                \
+    static void name(const struct plane *p, const int srow,                \
+                     const int scol, int *alt, const struct xyz target,    \
+                     int *bearing, const bool cleared_exit,                \
+                     const struct traffic_view *view,                      \
+                     struct frame *frame) {                                \
+        next_move(p, srow, scol, alt, target, bearing, cleared_exit,      \
+                  view, frame, isjet, to_airport);                         \
     }
+MOVE_KERNEL(jet_to_exit, true, false)
+MOVE_KERNEL(jet_to_airport, true, true)
+MOVE_KERNEL(prop_to_exit, false, false)
+MOVE_KERNEL(prop_to_airport, false, true)
+
+move_kernel *move_kernel_for(const struct plane *p) {
+    static move_kernel *const kernels[2][2] = {
+        { prop_to_exit, prop_to_airport },
+        { jet_to_exit, jet_to_airport },
+    };
+    return kernels[p->isjet][p->target_airport];
 }
 
-static struct airport *get_airport_xy(int r, int c) {
-    for (int i = 0; i < n_airports; i++) {
-        if (airports[i].row == r && airports[i].col == c)
-            return &airports[i];
-    }
-
-    return NULL;
-}
-
-static struct xyz backtrack(int *tick, bool *cleared_exit,
-                            struct course **cend,
+static struct xyz backtrack(int *tick, bool *cleared_exit, struct plane *p,
                             struct frame **lfrend) {
     --*tick;
-    struct course *prev = (*cend)->prev;
-    if (prev == NULL) {
-        struct xyz pos = (*cend)->pos;
+    if (p->len < 2) {
+        struct xyz pos = course_end(p)->pos;
         errexit('x', "Aieee.  Plane at (%d, %d, %d) is impossible.",
                 pos.row, pos.col, pos.alt);
     }
+    p->len--;
+    struct course *prev = course_end(p);
     struct xyz rv = prev->pos;
-    *cleared_exit = prev->cleared_exit;
-    free(*cend);
-    *cend = prev;
-    prev->next = NULL;
+    // As it was when moving on from there:  An entry has the flag from
+    // before it.
+    *cleared_exit = prev->cleared_exit ||
+                    clears_exit(rv.row, rv.col, rv.alt);
 
-    struct frame *fr = *lfrend;
-    *lfrend = fr->prev;
-    (*lfrend)->next = NULL;
-    free_op_courses(fr->opc_start);
-    free(fr);
+    --*lfrend;
 
     return rv;
 }
 
-
-static void free_op_courses(struct op_courses *oc) {
-    while (oc) {
-        struct op_courses *next = oc->next;
-        free(oc);
-        oc = next;
-    }
-}
-
-static void free_framelist(struct frame *fp) {
-    while (fp) {
-        struct frame *next = fp->next;
-
-        free_op_courses(fp->opc_start);
-        free(fp);
-        fp = next;
-    }
-}
-
-static void log_course(const struct plane *p) {
+void log_course(const struct plane *p) {
     fprintf(logff, "Plotting plane %c's course from %d:(%d, %d, %d) to "
                    "%d:(%d, %d, %d)\n", p->id, p->start_tm,
-            p->start->pos.row, p->start->pos.col, p->start->pos.alt,
-            p->end_tm, p->end->pos.row, p->end->pos.col, p->end->pos.alt);
-    int tick = p->start_tm;
-    struct course *c = p->start;
-    for ( ; c; tick++, c = c->next) {
-        fprintf(logff, "\t%c %d: (%d, %d, %d) bearing %s\n", p->id, tick,
+            p->course[0].pos.row, p->course[0].pos.col, p->course[0].pos.alt,
+            p->end_tm, course_end(p)->pos.row, course_end(p)->pos.col,
+            course_end(p)->pos.alt);
+    for (int i = 0; i < p->len; i++) {
+        const struct course *c = &p->course[i];
+        fprintf(logff, "\t%c %d: (%d, %d, %d) bearing %s\n", p->id,
+                p->start_tm + i,
                 c->pos.row, c->pos.col, c->pos.alt,
                 bearings[c->bearing].shortname);
         if (c->bearing < 0)
@@ -500,39 +655,142 @@ static void log_course(const struct plane *p) {
     }
 }
 
-static void log_all_courses() {
+void log_all_courses() {
     for (struct plane *p = plstart; p; p = p->next)
         log_course(p);
 }
 
-static void make_new_fr(struct frame **endp);
+
+static inline void make_new_fr(struct frame **endp) {
+    struct frame *newfr = *endp + 1;
+    newfr->depth = (*endp)->depth + 1;
+    *endp = newfr;
+}
 
 // The "record" longest course planes of type jet & prop.
 struct record { int steps, moves; };
 static struct record rec_jet, rec_prop;  // static init. == zeros
 
+// Totals over the run of the routes found, by which "--tune" scores the
+// weights.
+static long total_routes, total_steps, total_backtracks;
+static int longest_route;
+
+// Where the routes are tallied instead, and the records left alone, while
+// a route's planned for no plane in the game (a shadow replay, or one
+// precomputed), to keep them out of the game's totals.
+struct plan_tally *plan_tally;
+
+// Count a route found in 'steps' search steps (or expansions) with
+// 'backtracks' backtracks, of 'moves' moves.
+// Count a route found in 'steps' and 'backtracks', 'moves' long, flown in
+// down a landing funnel if 'funnel'.
+void count_route(int steps, int backtracks, int moves, bool funnel) {
+    pthread_mutex_lock(&record_lock);
+    if (plan_tally) {
+        plan_tally->routes++;
+        plan_tally->steps += steps;
+        plan_tally->backtracks += backtracks;
+        if (moves > plan_tally->moves)
+            plan_tally->moves = moves;
+        plan_tally->funnel_landings += funnel;
+        pthread_mutex_unlock(&record_lock);
+        return;
+    }
+    total_routes++;
+    total_steps += steps;
+    total_backtracks += backtracks;
+    if (moves > longest_route)
+        longest_route = moves;
+    n_funnel_landings += funnel;
+    pthread_mutex_unlock(&record_lock);
+}
+
+void get_plan_totals(long *routes, long *steps) {
+    pthread_mutex_lock(&record_lock);
+    *routes = total_routes;
+    *steps = total_steps;
+    pthread_mutex_unlock(&record_lock);
+}
+
+void log_plan_totals() {
+    fprintf(logff, "Planner totals at time %d: %ld routes, %ld steps, "
+                   "%ld backtracks, longest route %d moves.\n", frame_no,
+            total_routes, total_steps, total_backtracks, longest_route);
+}
+
+struct trace_sel trace_sel;     // static init. == off
+
+// Select what to trace from 'spec', of the form
+//     <plane>[:<tick>[-<tick>][:<row>,<col>[-<row>,<col>]]]
+// where the plane or the first tick can be '*' for any.  An empty 'spec'
+// turns tracing off.  Returns false, leaving the selection as it was, if
+// 'spec' doesn't parse.
+bool set_trace(const char *spec) {
+    struct trace_sel sel = { .on = true, .id = '\0',
+                             .from = 0, .to = INT_MAX,
+                             .row0 = 0, .col0 = 0,
+                             .row1 = INT_MAX, .col1 = INT_MAX };
+    int n;
+
+    if (*spec == '\0') {
+        trace_sel.on = false;
+        return true;
+    }
+    if (*spec != '*' && !isalpha(*spec))
+        return false;
+    if (*spec != '*')
+        sel.id = *spec;
+    spec++;
+
+    if (*spec == ':') {
+        spec++;
+        if (*spec == '*')
+            spec++;
+        else {
+            if (sscanf(spec, "%d%n", &sel.from, &n) != 1)
+                return false;
+            spec += n;
+            sel.to = sel.from;
+            if (*spec == '-') {
+                if (sscanf(spec+1, "%d%n", &sel.to, &n) != 1)
+                    return false;
+                spec += n+1;
+            }
+        }
+    }
+    if (*spec == ':') {
+        spec++;
+        if (sscanf(spec, "%d,%d%n", &sel.row0, &sel.col0, &n) != 2)
+            return false;
+        spec += n;
+        sel.row1 = sel.row0;  sel.col1 = sel.col0;
+        if (*spec == '-') {
+            if (sscanf(spec+1, "%d,%d%n", &sel.row1, &sel.col1, &n) != 2)
+                return false;
+            spec += n+1;
+        }
+    }
+    if (*spec != '\0')
+        return false;
 
-void plot_course(struct plane *p, int row, int col, int alt) {
-    const bool trace = (p->id == 'i' && frame_no == 575);
+    trace_sel = sel;
+    return true;
+}
 
-    struct frame *frstart = malloc(sizeof *frstart);
-    struct frame *frend = frstart;
-    frstart->prev = frstart->next = NULL;
-    frstart->opc_start = NULL;
-    struct op_courses *opc_end = NULL;
+enum planner_kind planner = PLANNER_GREEDY;
+double astar_weight = 1.0;
 
+// The bearing a new plane at (row, col, alt) starts out with.
+int start_bearing(int row, int col, int alt) {
     assert(alt == 7 || alt == 0);
-    int bearing = alt ? calc_bearing(row, col)
-                      : get_airport_xy(row, col)->bearing;
-    bool cleared_exit = false;
-    struct xyz target;
+    return alt ? calc_bearing(row, col) : get_airport_xy(row, col)->bearing;
+}
 
-    for (struct plane *pi = plstart; pi; pi = pi->next) {
-        if (pi == p)
-            continue;
-        new_op_course(pi->current, &frstart->opc_start, &opc_end, pi->isjet);
-    }
-    incr_opc(frstart->opc_start);
+// The position plane 'p' has to reach:  Its exit at altitude 9, or the
+// square it lands at its airport from at altitude 1.
+struct xyz plane_target(const struct plane *p) {
+    struct xyz target;
 
     if (p->target_airport) {
         struct airport *a = get_airport(p->target_num);
@@ -553,27 +811,406 @@ void plot_course(struct plane *p, int row, int col, int alt) {
         target.row = e->row;
         target.col = e->col;
     }
-    tracelog(trace, "Tracing plane %c's course from %d:(%d, %d, %d)@%d to "
+    return target;
+}
+
+// A lower bound on the ticks 'p' needs to get from 'c' to its target.
+int tick_bound(const struct plane *p, const struct course *c) {
+    struct xyz target = plane_target(p);
+    int moves = imax(abs(c->pos.row - target.row),
+                     imax(abs(c->pos.col - target.col),
+                          abs(c->pos.alt - target.alt)));
+    int ctg = cost_to_go(p, c->pos.row, c->pos.col, c->pos.alt, c->bearing,
+                         c->cleared_exit ||
+                         clears_exit(c->pos.row, c->pos.col, c->pos.alt));
+    moves = imax(moves, ctg);
+    return p->isjet ? moves : 2*moves;
+}
+
+// Add the last of 'p's course after it's reached its target at 'tick'-1.
+void finish_course(struct plane *p, int tick, bool cleared_exit,
+                   bool trace) {
+    struct xyz pos = course_end(p)->pos;
+    if (p->target_airport) {
+        if (!p->isjet) {
+            add_course_elem(p, pos.row, pos.col, pos.alt,
+                            course_end(p)->bearing,
+                            cleared_exit, trace ? tick : 0);
+            tick++;
+        }
+        add_course_elem(p, -1, -1, -2, -1, cleared_exit,
+                        trace ? tick : 0);
+        p->end_tm = tick;
+    } else {
+        // For an exit, the plane disappears at reaching it.
+        p->end_tm = tick-1;
+        course_end(p)->at_exit = true;
+    }
+}
+
+// End 'p's partial route at 'tick', its course laid on to the move it goes
+// on with at the tick after:  That move's reserved along with the route,
+// so no plane planned after it can take it, until the route's carried on
+// from its end (see start_search()).  A prop's held there a tick, so that
+// tick's laid too.
+void end_partial(struct plane *p, int tick) {
+    p->end_tm = tick;
+    const struct course c = *course_end(p);
+    if (!p->isjet && (tick+2)%2 == 1 && c.pos.row != 0 && c.pos.col != 0 &&
+            c.pos.row != board_height-1 && c.pos.col != board_width-1) {
+        add_course_elem(p, c.pos.row, c.pos.col, c.pos.alt, c.bearing,
+                        c.cleared_exit || clears_exit(c.pos.row, c.pos.col,
+                                                      c.pos.alt), 0);
+    }
+}
+
+// Drop whatever's in 'p's course after 'tick'.
+void truncate_course(struct plane *p, int tick) {
+    if (last_tick(p) > tick)
+        p->len = tick - p->start_tm + 1;
+}
+
+// The order to try a funnel's moves in:  Straight on, then the least turn,
+// descending first.
+static const signed char funnel_lanes[15] = {
+    6, 7, 8, 3, 9, 4, 10, 5, 11, 0, 12, 1, 13, 2, 14,
+};
+
+// Fly a plane which reaches its landing funnel in down it ("-F")?  The
+// bidirectional search always does, as its landing tree follows the funnel.
+bool fly_funnels = false;
+int n_funnel_landings;
+
+// Fly airport-bound 'p' the rest of the way in down its landing funnel,
+// from its course's last entry at '*tick'-1, taking at each move the first
+// of the funnel's moves the traffic leaves free, and with a landing tree
+// 'lt', that the tree has the rest of the way in from.  Returns the moves
+// it took, with '*tick' past the arrival, or 0, with the course as it was,
+// if it's not in the funnel or the traffic's in the way.
+static int fly_funnel(struct plane *p, int *tick, bool *cleared_exit,
+                      struct xyz target, struct landing_tree *lt,
+                      bool trace) {
+    const struct course *c = course_end(p);
+    int row = c->pos.row, col = c->pos.col, alt = c->pos.alt;
+    int bearing = c->bearing;
+    bool cleared = *cleared_exit;
+    if (!funnel_moves(p, row, col, alt, bearing, cleared))
+        return 0;
+    TRACE(trace, "Flying plane %c down its landing funnel from "
+                 "%d:(%d, %d, %d)@%d\n", p->id, *tick - 1, row, col, alt,
+          bearings[bearing].degree);
+
+    int t = *tick, moves = 0;
+    while (row != target.row || col != target.col || alt != target.alt) {
+        // A prop keeps its place on odd ticks.
+        if (!p->isjet && t%2 == 1) {
+            add_course_elem(p, row, col, alt, bearing, cleared,
+                            trace ? t : 0);
+            t++;
+            continue;
+        }
+        unsigned int lanes = funnel_moves(p, row, col, alt, bearing, cleared);
+        int i;
+        struct xy rc;
+        for (i = 0; i < 15; i++) {
+            const int lane = funnel_lanes[i];
+            if (!(lanes & 1u << lane))
+                continue;
+            struct blp blocker;
+            const int nb = (bearing + lane/3 - 2) & 7;
+            const int nalt = alt + lane%3 - 1;
+            rc = step_to(row, col, nb);
+            if (check_move(p, row, col, alt, rc, nalt, target, cleared, t,
+                           &blocker) != MOVE_OK)
+                continue;
+            if (lt && !landing_reaches(lt, rc.row, rc.col, nalt, nb,
+                                       cleared || clears_exit(rc.row, rc.col,
+                                                              nalt), t))
+                continue;
+            bearing = nb;
+            alt = nalt;
+            break;
+        }
+        if (i == 15) {
+            TRACE(trace, "Funnel blocked at tick %d; searching on.\n", t);
+            truncate_course(p, *tick - 1);
+            return 0;
+        }
+        row = rc.row;  col = rc.col;
+        add_course_elem(p, row, col, alt, bearing, cleared, trace ? t : 0);
+        t++;
+        moves++;
+        if (!cleared && clears_exit(row, col, alt))
+            cleared = true;
+    }
+
+    *tick = t;
+    *cleared_exit = cleared;
+    return moves;
+}
+
+// A greedy search under way, which can stop at the end of a time slice
+// and carry on later where it left off.  Its frame stack is in the
+// search_arena of the thread it's on, so a thread has only one at a time.
+struct greedy_search {
+    struct plane *p;
+    struct course root;
+    int root_tm;
+    struct frame *frstart, *frend;
+    struct traffic_view view;
+    struct xyz target;
+    move_kernel *move;
+    bool trace;
+    enum planner_kind kind;
+    const volatile bool *cancel;    // Given up on once this is set.
+    bool bidir;                 // Meeting a landing tree?
+    struct landing_tree landing;
+    bool coarse;                // Kept to a block route?
+    struct block_route route;
+    int step_limit;
+    struct failed_set failed;
+    // Where the search has got to.
+    int tick, row, col, alt, bearing;
+    bool cleared_exit;
+    int steps, moves, backtracks;
+};
+
+// Dominance pruning:  The greedy search's candidates from a state are all
+// the moves the rules and the traffic allow from it, and which those are
+// depends on nothing but the state, its tick, and the search's fixed
+// setup (target, block route, landing tree), not the way there.  So once
+// every candidate from a state has been backtracked over, there's no
+// route from it at that tick, and reaching it again by another way can
+// be skipped.  Only moves on the odd ticks a prop holds through aren't
+// states of their own; their frames are skipped over in backtracking and
+// aren't recorded.
+//
+// Besides the same state, cleared_exit=true is dominated by its
+// cleared_exit=false twin:  Clearing the exit only adds rules (keeping out
+// of the edge band and the target airport's exclusion zone) and is never
+// undone, so the moves from the cleared twin, and the moves on from those,
+// are among the uncleared twin's.  A different bearing, though, turns to
+// a different set of headings, so no bearing dominates another.
+//
+// States are keyed by their tick less the search's root tick, their
+// position and bearing, and the flag, in 29 bits.  A search backtracks
+// out of at most as many states as it takes steps, so the set never fills.
+
+#define FAILED_SLOTS 512        // Power of 2, over MAX_STEPS.
+
+static inline unsigned int state_key(const struct course *c, int depth,
+                                     bool cleared_exit) {
+    return (((((unsigned int) depth << 6 | c->pos.row) << 7 | c->pos.col)
+             << 4 | c->pos.alt) << 3 | c->bearing) << 1 | cleared_exit;
+}
+
+// Is 'key' in 'fs'?  Or if 'add', put it in.
+static bool failed_probe(struct failed_set *fs, unsigned int key, bool add) {
+    key |= 1u << 31;            // So no key is 0, an empty slot.
+    unsigned int i = (key * 2654435761u) >> 23;
+    for ( ; fs->slots[i]; i = (i+1) & (FAILED_SLOTS-1)) {
+        if (fs->slots[i] == key)
+            return true;
+    }
+    if (add && fs->n < FAILED_SLOTS*3/4) {
+        fs->slots[i] = key;
+        fs->n++;
+    }
+    return false;
+}
+
+bool prune_dominated = true;
+int n_dominance_prunes;
+
+// Note that there's no route from 'c', the state of search 's' at 'depth'.
+static void failed_add(struct greedy_search *s, const struct course *c,
+                       int depth) {
+    struct failed_set *fs = &s->failed;
+    if (!prune_dominated)
+        return;
+    if (fs->slots == NULL || fs->version != resv_version) {
+        // The traffic's changed since (between slices):  Start over.
+        if (fs->slots == NULL)
+            fs->slots = arena_alloc(&search_arena,
+                                    FAILED_SLOTS * sizeof(*fs->slots));
+        memset(fs->slots, 0, FAILED_SLOTS * sizeof(*fs->slots));
+        fs->n = 0;
+        fs->version = resv_version;
+    }
+    bool cleared = c->cleared_exit ||
+                   clears_exit(c->pos.row, c->pos.col, c->pos.alt);
+    failed_probe(fs, state_key(c, depth, cleared), true);
+}
+
+// Has search 's' already found there's no route from 'c' at 'depth', or
+// from a state which dominates it?
+static bool dominated(struct greedy_search *s, const struct course *c,
+                      int depth) {
+    struct failed_set *fs = &s->failed;
+    if (fs->slots == NULL || fs->version != resv_version)
+        return false;
+    bool cleared = c->cleared_exit ||
+                   clears_exit(c->pos.row, c->pos.col, c->pos.alt);
+    return failed_probe(fs, state_key(c, depth, cleared), false) ||
+           (cleared && failed_probe(fs, state_key(c, depth, false), false));
+}
+
+// Set up 's' to search for 'p's course on from its last entry, at 'tick',
+// as planner 'kind' does.
+static void greedy_begin(struct greedy_search *s, struct plane *p, int tick,
+                         enum planner_kind kind) {
+    const struct course *root = course_end(p);
+    *s = (struct greedy_search) {
+        .p = p, .root = *root, .root_tm = tick,
+        .view = { .tick0 = tick+1 },
+        .target = plane_target(p), .move = move_kernel_for(p),
+        .trace = tracing(p, root->pos.row, root->pos.col, tick),
+        .tick = tick+1, .row = root->pos.row, .col = root->pos.col,
+        .alt = root->pos.alt, .bearing = root->bearing,
+        .cleared_exit = root->cleared_exit ||
+                        clears_exit(root->pos.row, root->pos.col,
+                                    root->pos.alt),
+        .kind = kind, .cancel = search_cancel,
+        .bidir = kind == PLANNER_BIDIR && p->target_airport,
+        .coarse = false, .step_limit = MAX_STEPS,
+        .failed = { .slots = NULL, .n = 0 },
+    };
+    if (s->bidir)
+        landing_begin(&s->landing, p, tick+1);
+
+    // Every step pushes at most one frame, so the whole stack fits in
+    // a single allocation, and backtracking only has to pop it.
+    assert(search_arena.in_use == 0);
+    s->frstart = s->frend = arena_alloc(&search_arena,
+                                        (MAX_STEPS+1) * sizeof *s->frstart);
+    s->frend->depth = 0;
+
+    TRACE(s->trace, "Tracing plane %c's course from %d:(%d, %d, %d)@%d to "
                     "(%d, %d, %d)\n",
-             p->id, frame_no, row, col, alt, bearings[bearing].degree,
-             target.row, target.col, target.alt);
+          p->id, tick, s->row, s->col, s->alt, bearings[s->bearing].degree,
+          s->target.row, s->target.col, s->target.alt);
+}
 
-    p->start = p->current = p->end = NULL;
-    add_course_elem(p, row, col, alt, bearing, false, trace ? frame_no : 0);
-    p->start_tm = p->current_tm = frame_no;
-    int tick = frame_no+1;
-    int steps = 0, moves = 0;
+int n_landing_prunes, n_route_prunes, n_route_retries;
+
+// Drop the candidates in 'frame', for a move from (row, col) at 'tick'-1,
+// which leave search 's's block route, or go into the landing funnel
+// somewhere its landing tree can't fly in from, and set '*alt' and
+// '*bearing' to the best of the rest, or '*alt' to -1 if there are none.
+static void prune_candidates(struct greedy_search *s, int row, int col,
+                             int tick, bool cleared_exit, struct frame *frame,
+                             int *alt, int *bearing) {
+    int n = 0;
+    for (int i = 0; i < frame->n_cand; i++) {
+        const struct step *c = &frame->cand[i];
+        struct xy rc = step_to(row, col, c->bearing);
+        if (s->coarse && !in_block_route(&s->route, rc.row, rc.col)) {
+            TRACE(s->trace, "Candidate move to %d:(%d, %d, %d)@%d leaves "
+                            "the block route.\n", tick, rc.row, rc.col,
+                  c->alt, bearings[c->bearing].degree);
+            __sync_fetch_and_add(&n_route_prunes, 1);
+            continue;
+        }
+        if (s->bidir &&
+                !landing_reaches(&s->landing, rc.row, rc.col, c->alt,
+                                 c->bearing,
+                                 cleared_exit || clears_exit(rc.row, rc.col,
+                                                             c->alt),
+                                 tick)) {
+            TRACE(s->trace, "Candidate move to %d:(%d, %d, %d)@%d can't "
+                            "meet the landing tree.\n", tick, rc.row, rc.col,
+                  c->alt, bearings[c->bearing].degree);
+            __sync_fetch_and_add(&n_landing_prunes, 1);
+            continue;
+        }
+        frame->cand[n++] = *c;
+    }
+    frame->n_cand = n;
+    if (n == 0) {
+        *alt = -1;
+        return;
+    }
+    *alt = frame->cand[n-1].alt;
+    *bearing = frame->cand[n-1].bearing;
+}
+
+static enum plan_result greedy_run(struct greedy_search *s,
+                                   const struct timespec *deadline,
+                                   const struct timespec *slice);
+
+// Kept to its block route, search 's' found no way through, after 'steps'
+// steps and 'backtracks' backtracks:  Search again from its root without
+// the route.
+static enum plan_result greedy_retry(struct greedy_search *s,
+                                     const struct timespec *deadline,
+                                     const struct timespec *slice,
+                                     int steps, int backtracks) {
+    struct plane *const p = s->p;
+    TRACE(s->trace, "No way through plane %c's block route; searching "
+                    "again without it.\n", p->id);
+    __sync_fetch_and_add(&n_route_retries, 1);
+    truncate_course(p, s->root_tm);
+    arena_reset(&search_arena);
+    greedy_begin(s, p, s->root_tm, s->kind);
+    s->steps = steps;
+    s->backtracks = backtracks;
+    s->step_limit = steps + MAX_STEPS;
+    return greedy_run(s, deadline, slice);
+}
+
+// Carry on search 's'.  If 'deadline' passes, settle for a partial route;
+// if 'slice' does, stop where it is and return PLAN_YIELD, to be called
+// again.
+static enum plan_result greedy_run(struct greedy_search *s,
+                                   const struct timespec *deadline,
+                                   const struct timespec *slice) {
+    struct plane *const p = s->p;
+    const bool trace = s->trace;
+    const struct course root = s->root;
+    const int root_tm = s->root_tm;
+    struct frame *const frstart = s->frstart;
+    struct frame *frend = s->frend;
+    const struct traffic_view view = s->view;
+    const struct xyz target = s->target;
+    move_kernel *const move = s->move;
+
+    int tick = s->tick, row = s->row, col = s->col, alt = s->alt;
+    int bearing = s->bearing;
+    bool cleared_exit = s->cleared_exit;
+    int steps = s->steps, moves = s->moves, backtracks = s->backtracks;
+    const int first_step = steps;
 
     /* Operation of the "plotting course" machine:
      *    (A) Get a frame for the current pos'n.
      *    (B) If frame has cands, step ahead to the best cand and return to (A).
      *    (C) If not, step back to parent frame and remove the cand and
      *        return to (B).
+     * It's stopped and carried on only at (A).
      */
     for (;;) {
-        if (++steps > 200) {
+        if (slice && steps > first_step && past_deadline(slice)) {
+            s->frend = frend;
+            s->tick = tick;  s->row = row;  s->col = col;  s->alt = alt;
+            s->bearing = bearing;  s->cleared_exit = cleared_exit;
+            s->steps = steps;  s->moves = moves;  s->backtracks = backtracks;
+            return PLAN_YIELD;
+        }
+        if (s->cancel && *s->cancel) {
+            TRACE(trace, "Search for plane %c's course called off at step "
+                         "%d.\n", p->id, steps);
+            truncate_course(p, root_tm);
+            arena_reset(&search_arena);
+            return PLAN_NONE;
+        }
+        if (++steps > s->step_limit) {
+            if (s->coarse)
+                return greedy_retry(s, deadline, slice, steps, backtracks);
+            fprintf(logff, "Plane '%c' stuck in an infinite loop at time "
+                           "%d.\n", p->id, frame_no);
             log_course(p);
-            errexit('8', "Plane %c stuck in an infinite loop.", p->id);
+            truncate_course(p, root_tm);
+            arena_reset(&search_arena);
+            return PLAN_NONE;
         }
 
         // Plane doesn't move if it's a prop and the tick is odd...
@@ -589,32 +1226,58 @@ void plot_course(struct plane *p, int row, int col, int alt) {
         }
 
         moves++;
-        calc_next_move(p, row, col, &alt, target, &bearing, cleared_exit,
-                       frend);
+        if (dominated(s, course_end(p), frend->depth)) {
+            TRACE(trace, "No route from %d:(%d, %d, %d)@%d, as found "
+                         "before.\n", tick-1, row, col, alt,
+                  bearings[bearing].degree);
+            __sync_fetch_and_add(&n_dominance_prunes, 1);
+            frend->n_cand = 0;
+            alt = -1;
+        } else {
+            move(p, row, col, &alt, target, &bearing, cleared_exit, &view,
+                 frend);
+            if ((s->bidir || s->coarse) && frend->n_cand > 0) {
+                prune_candidates(s, row, col, tick, cleared_exit, frend,
+                                 &alt, &bearing);
+            }
+        }
         assert((alt < 0) == (frend->n_cand <= 0));
         while (frend->n_cand <= 0) {
-            tracelog(trace, "Backtracking at step %d move %d tick %d\n",
-                     steps, moves, tick);
-            struct xyz bt_pos = backtrack(&tick, &cleared_exit, &p->end,
+            if (frend == frstart) {
+                if (s->coarse) {
+                    return greedy_retry(s, deadline, slice, steps,
+                                        backtracks);
+                }
+                fprintf(logff, "No route for plane '%c' from (%d, %d, %d) "
+                               "at time %d.\n", p->id, root.pos.row,
+                        root.pos.col, root.pos.alt, frame_no);
+                truncate_course(p, root_tm);
+                arena_reset(&search_arena);
+                return PLAN_NONE;
+            }
+            TRACE(trace, "Backtracking at step %d move %d tick %d\n",
+                  steps, moves, tick);
+            backtracks++;
+            failed_add(s, course_end(p), frend->depth);
+            struct xyz bt_pos = backtrack(&tick, &cleared_exit, p,
                                           &frend);
             moves--;
 
             // Check for a prop. plane's non-move.
             // TODO: Do we have to worry about the "pop out of an exit" move
             // that props get at their first tick?
-            if (frend->n_cand == -3) {
-                tracelog(trace,
-                         "Backtracking over prop's non-move at tick %d\n",
-                         tick);
+            if (frend->n_cand == -3 && frend != frstart) {
+                TRACE(trace, "Backtracking over prop's non-move at tick %d\n",
+                      tick);
                 assert(!p->isjet);
-                bt_pos = backtrack(&tick, &cleared_exit, &p->end, &frend);
+                bt_pos = backtrack(&tick, &cleared_exit, p, &frend);
                 assert(frend->n_cand != -3);
             }
 
             row = bt_pos.row;  col = bt_pos.col;
-            tracelog(trace, "After backtracking:  %d: pos(%d, %d, %d) and %d "
-                            "remaining candidates\n", tick, bt_pos.row,
-                     bt_pos.col, bt_pos.alt, frend->n_cand - 1);
+            TRACE(trace, "After backtracking:  %d: pos(%d, %d, %d) and %d "
+                         "remaining candidates\n", tick, bt_pos.row,
+                  bt_pos.col, bt_pos.alt, frend->n_cand - 1);
 
             if (--frend->n_cand > 0) {
                 // We've found a new candidate that's available after
@@ -623,38 +1286,64 @@ void plot_course(struct plane *p, int row, int col, int alt) {
                 bearing = frend->cand[frend->n_cand-1].bearing;
                 break;
             }
-            tracelog(trace, "No new candidates found at tick %d.  Backtracking "
-                            "again.\n", tick);
+            TRACE(trace, "No new candidates found at tick %d.  Backtracking "
+                         "again.\n", tick);
         }
+
         if (alt) {
-            row += bearings[bearing].drow;
-            col += bearings[bearing].dcol;
+            row += bearing_drow[bearing];
+            col += bearing_dcol[bearing];
+        }
+
+        // Out of time, or at the reservation table's horizon, with room
+        // for a prop's hold after the move?  The course so far ends where
+        // there's a move to make, so it'll do until the rest is found, if
+        // the caller takes a partial route.
+        const bool at_horizon = tick+1 - frame_no >= MAX_TICKS;
+        if (deadline && tick-1 - root_tm >= MIN_PREFIX &&
+                (at_horizon || past_deadline(deadline))) {
+            add_course_elem(p, row, col, alt, bearing, cleared_exit,
+                            trace ? tick : 0);
+            end_partial(p, tick-1);
+            arena_reset(&search_arena);
+            return PLAN_PARTIAL;
+        }
+        if (at_horizon) {
+            if (s->coarse)
+                return greedy_retry(s, deadline, slice, steps, backtracks);
+            fprintf(logff, "No route for plane '%c' from (%d, %d, %d) "
+                           "within the horizon at time %d.\n", p->id,
+                    root.pos.row, root.pos.col, root.pos.alt, frame_no);
+            truncate_course(p, root_tm);
+            arena_reset(&search_arena);
+            return PLAN_NONE;
         }
 
         add_course_elem(p, row, col, alt, bearing, cleared_exit,
                         trace ? tick : 0);
         tick++;
 
-        if (row == target.row && col == target.col && alt == target.alt) {
-            // We've reached the target.  Clean-up and return.
-            if (p->target_airport) {
-                if (!p->isjet) {
-                    add_course_elem(p, row, col, alt, bearing, cleared_exit,
-                                    trace ? tick : 0);
-                    tick++;
-                }
-                add_course_elem(p, -1, -1, -2, -1, cleared_exit,
-                                trace ? tick : 0);
-                p->end_tm = tick;
-            } else {
-                // For an exit, the plane disappears at reaching it.
-                p->end_tm = tick-1;
-                p->end->at_exit = true;
-            }
+        if (!cleared_exit && clears_exit(row, col, alt))
+            cleared_exit = true;
 
-            free_framelist(frstart);
+        bool arrived = row == target.row && col == target.col &&
+                       alt == target.alt;
+        bool funnel = false;
+        if (!arrived && p->target_airport && (fly_funnels || s->bidir) &&
+                tick + 2*FUNNEL_DEPTH - frame_no < MAX_TICKS) {
+            int n = fly_funnel(p, &tick, &cleared_exit, target,
+                               s->bidir ? &s->landing : NULL, trace);
+            moves += n;
+            arrived = funnel = n > 0;
+        }
+        if (arrived) {
+            // We've reached the target.  Clean-up and return.
+            finish_course(p, tick, cleared_exit, trace);
+            arena_reset(&search_arena);
+            count_route(steps, backtracks, moves, funnel);
 
-            if (!quiet) {
+            if (!quiet && !plan_tally) {
+                pthread_mutex_lock(&record_lock);
                 struct record *rec = p->isjet ? &rec_jet : &rec_prop;
                 if (steps > rec->steps || moves > rec->moves) {
                     if (steps > rec->steps)
@@ -667,26 +1356,369 @@ void plot_course(struct plane *p, int row, int col, int alt) {
                     log_course(p);
                     log_all_courses();
                 }
+                pthread_mutex_unlock(&record_lock);
             }
 
-            return;
+            return PLAN_FOUND;
         }
 
-        if (!cleared_exit && alt > 1 && ((row > 2 && row < board_height-3 &&
-                col > 2 && col < board_width-3) || alt < 6 || alt == 9)) {
-            cleared_exit = true;
+        make_new_fr(&frend);
+    }
+}
+
+static double ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 +
+           (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Planning time for the current frame.
+static struct timespec deadline;
+static bool have_deadline;
+
+// Start the clock on a frame's planning, which may take 'budget_ms'
+// (0 for as long as it takes).
+void start_plan_clock(unsigned int budget_ms) {
+    have_deadline = budget_ms > 0;
+    if (!have_deadline)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_nsec += budget_ms % 1000 * 1000000L;
+    deadline.tv_sec += budget_ms / 1000 + deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+}
+
+const struct timespec *plan_deadline() {
+    return have_deadline ? &deadline : NULL;
+}
+
+bool past_deadline(const struct timespec *d) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > d->tv_sec ||
+           (now.tv_sec == d->tv_sec && now.tv_nsec >= d->tv_nsec);
+}
+
+// Begin planning 'p's course on from its last entry, which is at 'tick',
+// with planner 'kind':  Give it its earliest arrival slot, and try A* if
+// that's the planner, or race the portfolio's strategies if that is.  If
+// that doesn't settle it, the greedy search is set up in 's', and PLAN_YIELD
+// returned for greedy_run() to carry it on.
+static enum plan_result begin_course(struct greedy_search *s, struct plane *p,
+                                     int tick,
+                                     const struct timespec *deadline,
+                                     enum planner_kind kind) {
+    // tick_bound() counts a prop's every other tick from its first, but
+    // its next move could come on the next tick.
+    int bound = tick_bound(p, course_end(p));
+    slot_earliest(p, tick + (p->isjet || bound == 0 ? bound : bound-1));
+    if (kind == PLANNER_PORTFOLIO)
+        return portfolio_course(p, tick, deadline);
+    if (kind == PLANNER_ASTAR) {
+        enum plan_result rv = astar_course(p, tick, deadline);
+        if (rv != PLAN_NONE || search_cancelled())
+            return rv;
+    }
+    greedy_begin(s, p, tick, kind);
+    if (kind == PLANNER_HIER)
+        s->coarse = coarse_route(p, tick, &s->route);
+    return PLAN_YIELD;
+}
+
+// Plan 'p's course on from its last entry, which is at 'tick', with
+// planner 'kind', settling for the start of a route if 'deadline' passes.
+enum plan_result plan_course(struct plane *p, int tick,
+                             const struct timespec *deadline,
+                             enum planner_kind kind) {
+    struct greedy_search s;
+    enum plan_result rv = begin_course(&s, p, tick, deadline, kind);
+    if (rv == PLAN_YIELD)
+        rv = greedy_run(&s, deadline, NULL);
+    return rv;
+}
+
+static void log_partial(const struct plane *p, enum plan_result rv) {
+    if (rv == PLAN_PARTIAL && !quiet) {
+        fprintf(logff, "Planning for plane '%c' ran out of time at time %d; "
+                       "its route so far reaches tick %d.\n", p->id,
+                frame_no, p->end_tm);
+    }
+}
+
+// Plan 'p's course on from its last entry, which is at 'tick', to its
+// target, without reserving it.  If 'deadline' passes first, the course
+// is left with the start of a route.  If no route is found, the course is
+// left as it was.
+enum plan_result find_course_until(struct plane *p, int tick,
+                                   const struct timespec *deadline) {
+    static double rec_ms;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    enum plan_result rv = plan_course(p, tick, deadline, planner);
+    log_partial(p, rv);
+
+    double ms = ms_since(&start);
+    if (!quiet) {
+        pthread_mutex_lock(&record_lock);
+        if (ms > rec_ms) {
+            rec_ms = ms;
+            fprintf(logff, "New record planning time: plane '%c' at time %d "
+                           "took %.3f ms.\n", p->id, frame_no, ms);
         }
+        pthread_mutex_unlock(&record_lock);
+    }
+    return rv;
+}
 
-        make_new_fr(&frend);
+// As find_course_until(), taking as long as it takes.  Returns whether a
+// route was found.
+bool find_course(struct plane *p, int tick) {
+    return find_course_until(p, tick, NULL) == PLAN_FOUND;
+}
+
+// Reserve what a plan for 'p' from 'tick' which ended with 'rv' added to
+// its course.  A partial route leaves the plane pending.
+static void commit_course(struct plane *p, int tick, enum plan_result rv) {
+    if (rv == PLAN_NONE)
+        return;
+    resv_add_course(p, tick+1);
+    p->pending = (rv == PLAN_PARTIAL);
+}
+
+// As find_course_until(), and reserve what's been added.
+static enum plan_result extend_course_until(struct plane *p, int tick,
+                                            const struct timespec *deadline) {
+    enum plan_result rv = find_course_until(p, tick, deadline);
+    commit_course(p, tick, rv);
+    return rv;
+}
+
+bool extend_course(struct plane *p, int tick) {
+    return extend_course_until(p, tick, NULL) == PLAN_FOUND;
+}
+
+// Does 'p's course after its start come too close to the reserved ones?
+static bool course_conflicts(const struct plane *p) {
+    for (int tick = p->start_tm + 1; tick <= last_tick(p); tick++) {
+        const struct course *c = course_at(p, tick);
+        if (c->at_exit && !slot_free(p, tick))
+            return true;
+        if (c->pos.alt <= 0 || c->at_exit)
+            continue;
+        struct xy rc = { .row = c->pos.row, .col = c->pos.col };
+        if (resv_adjacent(rc, c->pos.alt, p->isjet, tick).alt > 0)
+            return true;
     }
+    return false;
 }
 
-static void make_new_fr(struct frame **endp) {
-    struct frame *newfr = malloc(sizeof *newfr);
-    newfr->opc_start = next_opc((*endp)->opc_start);
-    newfr->prev = *endp;
-    newfr->next = NULL;
-    assert((*endp)->next == NULL);
-    (*endp)->next = newfr;
-    *endp = newfr;
+struct batch {
+    struct plane **planes;
+    enum plan_result *result;
+};
+
+static void plan_job(void *arg, int i) {
+    struct batch *b = arg;
+    b->result[i] = find_course_until(b->planes[i], frame_no, plan_deadline());
+}
+
+int n_parallel_planned, n_parallel_replanned;
+
+// Route the planes which appeared this tick, whose courses have been
+// begun with start_course().  With worker threads, they're all planned at
+// once against the courses from before this tick, and then reserved in
+// order, replanning any which runs into one reserved before it.  Those
+// which can't be routed are left with just their starting position, and
+// those which run out of time with the start of a route, pending.
+void plan_new_courses(struct plane *planes[], int n) {
+    if (n_workers <= 1 || n <= 1) {
+        for (int i = 0; i < n; i++) {
+            if (adopt_route(planes[i]))
+                resv_add_course(planes[i], frame_no+1);
+            else
+                extend_course_until(planes[i], frame_no, plan_deadline());
+        }
+        return;
+    }
+
+    // Those with a precomputed route can take it, and the others are
+    // planned on the workers.
+    enum plan_result result[n];
+    struct plane *to_plan[n];
+    int n_to_plan = 0;
+    for (int i = 0; i < n; i++) {
+        result[i] = adopt_route(planes[i]) ? PLAN_FOUND : PLAN_NONE;
+        if (result[i] == PLAN_NONE)
+            to_plan[n_to_plan++] = planes[i];
+    }
+    enum plan_result planned[n];
+    struct batch b = { .planes = to_plan, .result = planned };
+    run_jobs(plan_job, &b, n_to_plan);
+    n_parallel_planned += n_to_plan;
+    for (int i = 0, j = 0; i < n; i++) {
+        if (j < n_to_plan && to_plan[j] == planes[i])
+            result[i] = planned[j++];
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct plane *p = planes[i];
+        if (result[i] == PLAN_NONE)
+            continue;
+        if (!course_conflicts(p)) {
+            resv_add_course(p, frame_no+1);
+            p->pending = (result[i] == PLAN_PARTIAL);
+            continue;
+        }
+        if (verbose) {
+            fprintf(logff, "The course planned in parallel for plane '%c' at "
+                           "time %d conflicts; replanning it.\n", p->id,
+                    frame_no);
+        }
+        n_parallel_replanned++;
+        truncate_course(p, p->start_tm);
+        extend_course_until(p, frame_no, plan_deadline());
+    }
+}
+
+// A frame's planning, done a slice at a time between the main loop's
+// keystrokes:  The routes of the pending planes are carried on, and then
+// the new planes routed, one search at a time.  Nothing's reserved until a
+// search ends, so the reservations the one under way has checked its
+// moves against stay put while it's stopped.  A* searches, portfolio
+// races, and planes planned together on the workers, are done within a
+// slice.
+static struct {
+    bool active;
+    struct plane *next_pending; // Where to look for the next pending plane.
+    struct plane **new_planes;
+    int n_new, next_new;
+    struct plane *cur;          // Whose search is under way, or NULL.
+    int cur_tick;               // The tick it's planning on from.
+    bool cur_pending, last_chance;
+    struct course escape[2];    // A pending one's move on from its route.
+    int n_escape;
+    struct greedy_search search;
+} slices;
+
+// Set up the planning of a frame:  Carry on the routes of the pending
+// planes, and then route the new planes 'planes', whose courses have been
+// begun with start_course().
+void begin_planning(struct plane *planes[], int n) {
+    slices.active = true;
+    slices.next_pending = plstart;
+    slices.new_planes = planes;
+    slices.n_new = n;
+    slices.next_new = 0;
+    slices.cur = NULL;
+}
+
+// Reserve the route of the plane whose search just ended with 'rv'.
+static void end_search(enum plan_result rv) {
+    struct plane *p = slices.cur;
+    slices.cur = NULL;
+    log_partial(p, rv);
+    commit_course(p, slices.cur_tick, rv);
+    if (!slices.cur_pending)
+        return;
+    if (rv == PLAN_NONE && slices.last_chance)
+        errexit('8', "Unable to route plane %c.", p->id);
+    if (rv == PLAN_NONE) {
+        // Hold on to its move onward for the next try.
+        append_course(p, slices.escape, slices.n_escape);
+        resv_add_course(p, p->end_tm+1);
+    }
+    if (rv == PLAN_FOUND && !quiet) {
+        fprintf(logff, "Finished planning the route of plane '%c' at "
+                       "time %d.\n", p->id, frame_no);
+        log_course(p);
+    }
+}
+
+// Start planning 'p's course on from 'tick'.  One whose route would end
+// before the next frame's orders gets as long as it takes.  A pending one's
+// move on from the end of its route is taken off first, to be free to it.
+static void start_search(struct plane *p, int tick, bool pending) {
+    if (pending) {
+        slices.n_escape = last_tick(p) - tick;
+        assert(slices.n_escape <= 2);
+        for (int i = 0; i < slices.n_escape; i++)
+            slices.escape[i] = *course_at(p, tick+1 + i);
+        resv_remove_course(p, tick+1);
+        truncate_course(p, tick);
+    }
+    slices.cur = p;
+    slices.cur_tick = tick;
+    slices.cur_pending = pending;
+    slices.last_chance = pending && p->end_tm <= frame_no+1;
+    enum plan_result rv = begin_course(&slices.search, p, tick,
+            slices.last_chance ? NULL : plan_deadline(), planner);
+    if (rv != PLAN_YIELD)
+        end_search(rv);
+}
+
+// Start on the next plane to plan, if there is one.
+static void next_search() {
+    while (slices.next_pending) {
+        struct plane *p = slices.next_pending;
+        slices.next_pending = p->next;
+        if (p->pending) {
+            start_search(p, p->end_tm, true);
+            return;
+        }
+    }
+    if (slices.next_new == slices.n_new) {
+        slices.active = false;
+    } else if (n_workers > 1 && slices.n_new > 1) {
+        plan_new_courses(slices.new_planes, slices.n_new);
+        slices.next_new = slices.n_new;
+    } else {
+        struct plane *p = slices.new_planes[slices.next_new++];
+        if (adopt_route(p))
+            resv_add_course(p, frame_no+1);
+        else
+            start_search(p, frame_no, false);
+    }
+}
+
+// Carry on the frame's planning until 'until' passes (or for as long as
+// it takes, if it's NULL).  Returns whether it's all done.
+bool plan_slice(const struct timespec *until) {
+    while (slices.active) {
+        if (slices.cur == NULL) {
+            next_search();
+            continue;
+        }
+        enum plan_result rv = greedy_run(&slices.search,
+                slices.last_chance ? NULL : plan_deadline(), until);
+        if (rv == PLAN_YIELD)
+            return false;
+        end_search(rv);
+    }
+    return true;
+}
+
+// Carry on planning the courses of the planes which ran out of time, from
+// where their routes so far end.
+void resume_courses() {
+    begin_planning(NULL, 0);
+    plan_slice(NULL);
+}
+
+// Begin a new plane's course with its position at (row, col, alt) now.
+void start_course(struct plane *p, int row, int col, int alt) {
+    p->course = NULL;
+    p->len = p->cap = 0;
+    add_course_elem(p, row, col, alt, start_bearing(row, col, alt), false, 0);
+    p->start_tm = p->current_tm = frame_no;
+    p->pending = false;
+    resv_stamp(p->id, p->isjet, p->course, frame_no);
+}
+
+// Route a new plane, returning false (with only its starting position in
+// its course) if no route was found.
+bool plot_course(struct plane *p, int row, int col, int alt) {
+    start_course(p, row, col, alt);
+    return extend_course(p, frame_no);
 }
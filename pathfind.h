@@ -2,24 +2,331 @@
 // This code may be distributed under the terms of the Affero General
 // Public License, ver. 3.  See the file "AGPLv3" for details.
 
+#include <pthread.h>
+#include <time.h>
+
 struct step { int bearing, alt, distance; };
 
-struct op_courses {
-    const struct course *c;
-    bool isjet;
-    struct op_courses *prev, *next;
+// A plane blocking a move:  Its bearing, altitude, and type.
+struct blp { int bearing, alt; bool isjet; };
+
+enum move_kind {
+    MOVE_ILLEGAL,       // Off the board, into an exclusion zone, etc.
+    MOVE_BLOCKED,       // Too close to another plane.
+    MOVE_OK,
+    MOVE_EXIT,          // Into the target exit.
+};
+extern enum move_kind check_move(const struct plane *p, int srow, int scol,
+                                 int alt, struct xy rc, int nalt,
+                                 struct xyz target, bool cleared_exit,
+                                 int tick, struct blp *blocker);
+extern enum move_kind check_static_move(const struct plane *p,
+                                        int srow, int scol, int alt,
+                                        struct xy rc, int nalt,
+                                        struct xyz target, bool cleared_exit);
+
+#define RESV_HORIZON 256    // Must be a power of 2.
+// How far past frame_no a search plans a course, leaving room for a
+// landing after it.
+#define MAX_TICKS (RESV_HORIZON - 8)
+struct resv_cell {
+    char id;                // '\0' if unreserved.
+    unsigned char bearing:4, isjet:1;   // 'bearing' is offset by 1.
+};
+
+extern unsigned int resv_version;
+extern void resv_init(void);
+extern void resv_clear(void);
+extern void resv_stamp(char id, bool isjet, const struct course *, int tick);
+extern void resv_unstamp(char id, const struct course *, int tick);
+extern void resv_add_course(const struct plane *, int tick);
+extern void resv_remove_course(const struct plane *, int tick);
+extern struct blp resv_adjacent(struct xy rc, int alt, bool imjet, int tick);
+extern bool resv_aligned(struct xy rc, int alt, int tick);
+extern int resv_block_load(int brow, int bcol, int tick);
+
+// A plane's candidate moves from a square, a lane each, to be checked
+// against the reservations together.
+#define CAND_LANES 16
+struct cand_batch {
+    signed char row[CAND_LANES], col[CAND_LANES], alt[CAND_LANES];
+} __attribute__((aligned(16)));
+struct move_checks {
+    unsigned int blocked, aligned;      // Bit 'i' for lane 'i'.
+    struct blp blocker[CAND_LANES];     // For each blocked lane.
+};
+extern void resv_check_moves(const struct cand_batch *, int n, struct xy src,
+                             int alt, bool imjet, int tick,
+                             struct move_checks *);
+
+extern void slots_clear(void);
+extern void slot_earliest(struct plane *, int earliest);
+extern bool slot_free(const struct plane *, int tick);
+extern void slot_book(const struct plane *);
+extern void slot_cancel(const struct plane *);
+extern void log_slots(void);
+
+#define CTG_INF 255
+#define FUNNEL_DEPTH 4          // Moves out from an airport's target.
+extern void costmap_init(void);
+extern void costmap_add_exit(const struct exitspec *);
+extern void costmap_clear(void);
+extern int cost_to_go(const struct plane *, int row, int col, int alt,
+                      int bearing, bool cleared_exit);
+extern unsigned int funnel_moves(const struct plane *, int row, int col,
+                                 int alt, int bearing, bool cleared_exit);
+extern int funnel_index(const struct plane *, int row, int col, int alt,
+                        int bearing, bool cleared_exit);
+extern int funnel_size(const struct plane *);
+extern unsigned int funnel_moves_at(const struct plane *, int i);
+extern int n_funnel_landings;
+
+// A landing tree:  The states of an airport-bound plane's landing funnel
+// which, as the traffic stands, can be flown in from at each tick of a
+// window, worked out backward from the target as the search asks.  See
+// landing.c.
+#define LANDING_WINDOW 64       // Ticks.
+struct landing_tree {
+    const struct plane *p;
+    struct xyz target;
+    int base;                   // Tick of bit 0.
+    unsigned long long *known, *ok;     // Bit 'tick-base' of each state.
+    int n_states;
 };
+extern void landing_begin(struct landing_tree *, const struct plane *,
+                          int tick);
+extern bool landing_reaches(struct landing_tree *, int row, int col, int alt,
+                            int bearing, bool cleared_exit, int tick);
+extern int n_landing_prunes;
+
+struct arena_chunk;
+struct arena {
+    struct arena_chunk *head, *cur;
+    size_t used;                // Bytes used in the current chunk.
+    size_t in_use, hiwater;     // Bytes used across all chunks.
+};
+
+extern void *arena_alloc(struct arena *, size_t);
+extern void arena_reset(struct arena *);
+
+// A search's read-only view of the other planes' committed courses:  The
+// reservation table as seen from the search's first move, so that a frame
+// needs only to know how deep into the search it is.
+struct traffic_view {
+    int tick0;                  // Tick of the position chosen at depth 0.
+};
+
+static inline int view_tick(const struct traffic_view *v, int depth) {
+    return v->tick0 + depth;
+}
 
 struct frame {
     int n_cand;
     struct step cand[15];
-    struct op_courses *opc_start;
-    struct frame *prev, *next;
+    int depth;
 };
 
+#define MAX_STEPS 200
+
+// The states a greedy search has found there's no route from.  See
+// dominated().
+struct failed_set {
+    unsigned int *slots;        // Open addressing; 0 if empty.
+    int n;
+    unsigned int version;       // resv_version when filled.
+};
+extern bool prune_dominated;
+extern int n_dominance_prunes;
+
+// How a search ended.  A partial route stops short of the target, at a
+// state that's known to have a free move onward, when the planning time
+// for the frame has run out.  That move's laid after its end; see
+// end_partial().  A search which yields has only stopped for
+// the main loop, to be carried on by plan_slice().
+enum plan_result { PLAN_NONE, PLAN_FOUND, PLAN_PARTIAL, PLAN_YIELD };
+#define MIN_PREFIX 2        // Fewest ticks in a partial route.
+
+// Weights of the greedy search's candidate scoring.  See "-H".
+struct heuristics {
+    int matchcourse_penalty;    // Moving along with a blocking plane.
+    int changealt_bonus;        // Leaving a blocker's altitude when pushed.
+    int aligned_div;            // Of the penalty, for aligning with a prop.
+    int minor_match_div;        // Of the penalty, for 1 altitude off.
+    int exit_mult;              // Of the penalty, as the bonus to exit.
+    int detour_weight;          // Of the cost-to-go's detour.
+    int corridor_penalty;       // Flying through an exit's corridor.
+    int block_load_weight;      // Per reserved position, on a coarse route.
+};
+extern struct heuristics heur;
+struct heur_param {
+    const char *name;
+    int *value;
+    int min;
+};
+extern const struct heur_param heur_params[];
+extern const int n_heur_params;
+extern __thread const struct heuristics *search_heur;
+extern __thread const volatile bool *search_cancel;
+
+static inline bool search_cancelled() {
+    return search_cancel && *search_cancel;
+}
+extern void count_route(int steps, int backtracks, int moves, bool funnel);
+struct plan_tally {
+    long routes, steps, backtracks;
+    int moves;                  // Of the longest.
+    int funnel_landings;
+};
+extern struct plan_tally *plan_tally;
+extern void get_plan_totals(long *routes, long *steps);
+
+extern const struct timespec *plan_deadline(void);
+extern bool past_deadline(const struct timespec *);
+
+// Holds the frame stack of the plot_course() in progress.  Each worker
+// thread has its own.
+extern __thread struct arena search_arena;
+extern pthread_mutex_t record_lock;
+
+extern int n_workers;
+extern void run_jobs(void (*fn)(void *arg, int i), void *arg, int n);
+
+
+// The board's static properties, square by square.  See cells.c.
+#define CELLS_MAX_ROWS 50
+#define CELLS_MAX_COLS 80
+enum cell_flags {
+    CELL_BOUNDARY = 1,          // On the edge of the board.
+    CELL_EDGE_BAND = 2,         // Within 2 of the edge, near the exits.
+    CELL_CORRIDOR = 4,          // Where new planes fly in from an exit.
+};
+#define CORRIDOR_DEPTH 5        // Squares in from the exit.
+struct cell {
+    unsigned char flags;
+    signed char exit_num, airport_num;      // -1 if none here.
+    unsigned short excl;        // Bit 'n' if in airport n's excl. zone.
+};
+extern struct cell cells[CELLS_MAX_ROWS][CELLS_MAX_COLS];
+extern void cells_init(void);
+extern void cells_add_exit(struct exitspec *);
+extern bool is_exit_at(int row, int col);
+extern struct airport *get_airport_xy(int row, int col);
+
+// The coarse grid the hierarchical planner ("-R hier") routes on first:
+// Blocks of BLOCK_SIZE by BLOCK_SIZE squares, over windows of BLOCK_WINDOW
+// ticks.  A block route is the blocks a coarse route passes through and
+// those next to them, which the greedy search then keeps to.  See
+// coarse.c.
+#define BLOCK_SIZE 4
+#define BLOCK_WINDOW 8          // Must divide RESV_HORIZON.
+#define BLOCK_ROWS ((CELLS_MAX_ROWS + BLOCK_SIZE-1) / BLOCK_SIZE)
+#define BLOCK_COLS ((CELLS_MAX_COLS + BLOCK_SIZE-1) / BLOCK_SIZE)
+#define HIER_MIN_MOVES 16       // Shortest crossing to route coarsely.
+struct block_route {
+    int n_hops;
+    bool in[BLOCK_ROWS][BLOCK_COLS];
+};
+extern bool long_crossing(const struct plane *);
+extern bool coarse_route(const struct plane *, int tick,
+                         struct block_route *);
+extern int n_route_prunes, n_route_retries;
+
+static inline bool in_block_route(const struct block_route *br, int row,
+                                  int col) {
+    return br->in[row / BLOCK_SIZE][col / BLOCK_SIZE];
+}
+
+// Has a plane at (row, col, alt) gotten clear of the exit it came in by?
+static inline bool clears_exit(int row, int col, int alt) {
+    return alt > 1 && (!(cells[row][col].flags & CELL_EDGE_BAND) ||
+                       alt < 6 || alt == 9);
+}
+
+// What planning to trace in the log:  That of plane 'id', or of any if
+// it's '\0', from tick 'from' through 'to', from squares in the box from
+// (row0, col0) to (row1, col1).  See set_trace().
+struct trace_sel {
+    bool on;
+    char id;
+    int from, to;
+    int row0, col0, row1, col1;
+};
+extern struct trace_sel trace_sel;
+
+// Is the planning for 'p' from (row, col) at 'tick' to be traced?  With
+// NO_TRACE defined, never, and the trace sites compile away.
+#ifdef NO_TRACE
+#define tracing(p, row, col, tick) false
+#else
+static inline bool tracing(const struct plane *p, int row, int col,
+                           int tick) {
+    if (__builtin_expect(!trace_sel.on, 1))
+        return false;
+    return (!trace_sel.id || p->id == trace_sel.id) &&
+           tick >= trace_sel.from && tick <= trace_sel.to &&
+           row >= trace_sel.row0 && row <= trace_sel.row1 &&
+           col >= trace_sel.col0 && col <= trace_sel.col1;
+}
+#endif
+
+// Log to the trace if 'trace'.  The arguments are only evaluated then.
+#define TRACE(trace, ...)                                       \
+    do {                                                        \
+        if (__builtin_expect((trace), 0))                       \
+            fprintf(logff, __VA_ARGS__);                        \
+    } while (0)
+
+extern int start_bearing(int row, int col, int alt);
+extern struct xyz plane_target(const struct plane *);
+extern int tick_bound(const struct plane *, const struct course *);
+extern void add_course_elem(struct plane *p, int row, int col, int alt,
+                            int bearing, bool cleared_exit, int trace_tick);
+extern void append_course(struct plane *p, const struct course *, int n);
+extern void finish_course(struct plane *p, int tick, bool cleared_exit,
+                          bool trace);
+extern void end_partial(struct plane *p, int tick);
+extern void log_course(const struct plane *);
+extern void log_all_courses(void);
+
+extern void start_course(struct plane *p, int row, int col, int alt);
+extern bool find_course(struct plane *p, int tick);
+extern enum plan_result find_course_until(struct plane *p, int tick,
+                                          const struct timespec *deadline);
+extern bool extend_course(struct plane *p, int tick);
+extern void plan_new_courses(struct plane *planes[], int n);
+extern int n_parallel_planned, n_parallel_replanned;
+extern void resume_courses(void);
+extern void begin_planning(struct plane *planes[], int n);
+extern bool plan_slice(const struct timespec *until);
+extern bool adopt_route(struct plane *p);
+extern void precompute_clear(void);
+extern int n_adopted, n_missed;
+extern int precomputed_courses(void);
+extern void truncate_course(struct plane *p, int tick);
+extern void resolve_contention(struct plane *newp);
+extern void repair_course(struct plane *newp);
+extern enum plan_result astar_course(struct plane *p, int tick,
+                                     const struct timespec *deadline);
+extern enum plan_result plan_course(struct plane *p, int tick,
+                                    const struct timespec *deadline,
+                                    enum planner_kind kind);
+extern enum plan_result portfolio_course(struct plane *p, int tick,
+                                         const struct timespec *deadline);
+extern int n_portfolio_races;
+extern void shadow_note(const struct plane *p);
+extern int n_shadowed, n_shadow_stale, n_shadow_disagreements,
+           n_shadow_drifted;
+
+// Choose plane 'p's next move from (srow, scol, *alt), heading *bearing,
+// putting its candidates in 'frame'.
+typedef void move_kernel(const struct plane *p, int srow, int scol, int *alt,
+                         struct xyz target, int *bearing, bool cleared_exit,
+                         const struct traffic_view *view,
+                         struct frame *frame);
+extern move_kernel *move_kernel_for(const struct plane *);
 
 // 'extern' for testing
 extern void calc_next_move(const struct plane *p, int srow, int scol, int *alt,
                            struct xyz target, int *bearing, bool cleared_exit,
+                           const struct traffic_view *view,
                            struct frame *frame);
-extern void remove_course_entries(struct course *c);
@@ -0,0 +1,181 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <time.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Portfolio races, for the portfolio planner ("-R portfolio"):  Which of
+// the planners, and which weights, route a plane fastest depends on the
+// traffic it has to get through, and a search that's slow with one is
+// often quick with another.  So each plane is planned by several
+// strategies at once, on the worker threads, each on its own copy of the
+// plane's course.  The first to find a route wins, and the rest are
+// called off; if the deadline passes with none found, the partial route
+// which leaves the least way to go wins.  With no workers to run them
+// on, or when the race is itself one of a batch of planes being planned
+// on the workers, the strategies are run in turn, in the order below,
+// until one finds a route.
+//
+// The strategies vary "-H"'s weights by a percentage of each.  Those for
+// the bidirectional and hierarchical planners only enter the race when
+// they'd plan differently from the greedy search:  For an airport-bound
+// plane, and a long crossing.
+
+static const struct strategy {
+    const char *name;
+    enum planner_kind kind;
+    int detour_pct, corridor_pct, matchcourse_pct;
+} strategies[] = {
+    { "greedy", PLANNER_GREEDY, 100, 100, 100 },
+    { "greedy, wide detours", PLANNER_GREEDY, 300, 100, 100 },
+    { "greedy, no corridors", PLANNER_GREEDY, 100, 0, 50 },
+    { "astar", PLANNER_ASTAR, 100, 100, 100 },
+    { "bidir", PLANNER_BIDIR, 100, 100, 100 },
+    { "hier", PLANNER_HIER, 100, 100, 100 },
+};
+#define N_STRATEGIES ((int) (sizeof(strategies) / sizeof(*strategies)))
+
+// Each strategy's wins, and the races' times, over the game.
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static int wins[N_STRATEGIES];
+static int n_unrouted;
+int n_portfolio_races;
+static double total_ms, longest_ms;
+
+struct race {
+    int tick;
+    const struct timespec *deadline;
+    int n;
+    int entrant[N_STRATEGIES];          // Index into strategies[].
+    struct plane q[N_STRATEGIES];       // Each one's copy of the plane.
+    enum plan_result result[N_STRATEGIES];
+    volatile int winner;                // The first to find a route, or -1.
+    volatile bool over, partial;
+};
+
+static void race_job(void *arg, int i) {
+    struct race *r = arg;
+    r->result[i] = PLAN_NONE;
+    // Run in turn, the rest needn't start once one has found a route, or
+    // once time's up and one has the start of one.
+    if (r->over || (r->partial && past_deadline(r->deadline)))
+        return;
+
+    const struct strategy *st = &strategies[r->entrant[i]];
+    struct heuristics h = heur;
+    h.detour_weight = heur.detour_weight * st->detour_pct / 100;
+    h.corridor_penalty = heur.corridor_penalty * st->corridor_pct / 100;
+    h.matchcourse_penalty = heur.matchcourse_penalty *
+                            st->matchcourse_pct / 100;
+    search_heur = &h;
+    search_cancel = &r->over;
+    r->result[i] = plan_course(&r->q[i], r->tick, r->deadline, st->kind);
+    search_heur = &heur;
+    search_cancel = NULL;
+
+    if (r->result[i] == PLAN_FOUND) {
+        if (__sync_bool_compare_and_swap(&r->winner, -1, i))
+            r->over = true;
+    } else if (r->result[i] == PLAN_PARTIAL) {
+        r->partial = true;
+    }
+}
+
+// Which entrant's partial route, if any, leaves the least way to go.
+static int best_partial(const struct race *r) {
+    int best = -1, best_bound = 0;
+    for (int i = 0; i < r->n; i++) {
+        if (r->result[i] != PLAN_PARTIAL)
+            continue;
+        int bound = tick_bound(&r->q[i], course_end(&r->q[i]));
+        if (best < 0 || bound < best_bound ||
+                (bound == best_bound && r->q[i].end_tm > r->q[best].end_tm)) {
+            best = i;
+            best_bound = bound;
+        }
+    }
+    return best;
+}
+
+static double ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e3 +
+           (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+// Plan 'p's course on from its last entry, which is at 'tick', by racing
+// the strategies, and give it the winner's.  If no route is found, the
+// course is left as it was.
+enum plan_result portfolio_course(struct plane *p, int tick,
+                                  const struct timespec *deadline) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct race r = { .tick = tick, .deadline = deadline, .n = 0,
+                      .winner = -1, .over = false, .partial = false };
+    for (int k = 0; k < N_STRATEGIES; k++) {
+        const struct strategy *st = &strategies[k];
+        if ((st->kind == PLANNER_BIDIR && !p->target_airport) ||
+                (st->kind == PLANNER_HIER && !long_crossing(p)))
+            continue;
+        struct plane *q = &r.q[r.n];
+        *q = *p;
+        q->course = NULL;
+        q->len = q->cap = 0;
+        append_course(q, p->course, p->len);
+        r.entrant[r.n++] = k;
+    }
+    run_jobs(race_job, &r, r.n);
+
+    const int w = r.winner >= 0 ? r.winner : best_partial(&r);
+    for (int i = 0; i < r.n; i++) {
+        if (i != w)
+            free_course(&r.q[i]);
+    }
+    double ms = ms_since(&start);
+    pthread_mutex_lock(&stats_lock);
+    n_portfolio_races++;
+    total_ms += ms;
+    if (ms > longest_ms)
+        longest_ms = ms;
+    if (w < 0)
+        n_unrouted++;
+    else
+        wins[r.entrant[w]]++;
+    pthread_mutex_unlock(&stats_lock);
+    if (w < 0)
+        return PLAN_NONE;
+
+    if (verbose) {
+        fprintf(logff, "Portfolio race for plane '%c' at time %d won by "
+                       "'%s' with a %s route after %.3f ms.\n", p->id,
+                frame_no, strategies[r.entrant[w]].name,
+                r.result[w] == PLAN_FOUND ? "full" : "partial", ms);
+    }
+    struct plane *const prev = p->prev, *const next = p->next;
+    free_course(p);
+    *p = r.q[w];
+    p->prev = prev;
+    p->next = next;
+    return r.result[w];
+}
+
+// Log how the races on 'board' (NULL for the default) went.
+void log_portfolio(const char *board) {
+    pthread_mutex_lock(&stats_lock);
+    fprintf(logff, "Portfolio wins on board '%s' at time %d:",
+            board ? board : "default", frame_no);
+    for (int k = 0; k < N_STRATEGIES; k++) {
+        fprintf(logff, "%s %s %d", k ? ";" : "", strategies[k].name,
+                wins[k]);
+    }
+    const int n = n_portfolio_races;
+    fprintf(logff, ".\nPortfolio races: %d, %d without a route; %.3f ms "
+                   "mean, %.3f ms longest.\n", n, n_unrouted,
+            n ? total_ms / n : 0, longest_ms);
+    pthread_mutex_unlock(&stats_lock);
+}
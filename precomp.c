@@ -0,0 +1,193 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <assert.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Speculative routes:  New planes only ever appear at an exit at altitude 7
+// or on the ground at an airport.  So while the main loop's waiting on
+// 'atc' for the next frame, plan a route from each of those to each target,
+// for a jet and for a prop, against the courses already committed.  When a
+// plane does appear, it can adopt the ready route, if the reservation table
+// hasn't changed from the one it was planned against.
+//
+// The routes are for the tick after the one they're computed in, and only
+// depend on the reservations after that, so the table's version only
+// counts changes after the current tick (see resv_version).
+//
+// Most of the routes are never flown, so they're tallied apart from the
+// game's totals, and a route's counted in them only once it's adopted.
+
+bool idle_planning = false;
+int n_adopted, n_missed;
+
+#define N_SPAWNS (EXIT_MAX + AIRPORT_MAX)
+#define N_ENTRIES (N_SPAWNS * N_SPAWNS * 2)
+
+struct cached_route {
+    int tick;                   // When the plane appears, or 0 if unset.
+    unsigned int version;       // resv_version it was planned against.
+    bool found;
+    struct plan_tally tally;    // Its search's steps, for count_route().
+    struct plane route;         // The dummy plane that was routed.
+};
+
+static struct cached_route cache[N_ENTRIES];
+static int next_entry;          // Round-robin over the frames.
+static int n_done, done_frame;  // Entries planned during frame 'done_frame'.
+
+// The starting position for spawn point 'i':  An exit, then an airport.
+static bool spawn_point(int i, struct xyz *pos) {
+    if (i < n_exits) {
+        pos->row = exits[i].row;  pos->col = exits[i].col;  pos->alt = 7;
+        return true;
+    }
+    i -= n_exits;
+    if (i < n_airports) {
+        pos->row = airports[i].row;  pos->col = airports[i].col;
+        pos->alt = 0;
+        return true;
+    }
+    return false;
+}
+
+// The target of target number 'i':  An exit, then an airport.
+static bool target_of(int i, bool *airport, int *num) {
+    if (i < n_exits) {
+        *airport = false;
+        *num = exits[i].num;
+        return true;
+    }
+    i -= n_exits;
+    if (i < n_airports) {
+        *airport = true;
+        *num = airports[i].num;
+        return true;
+    }
+    return false;
+}
+
+static inline int entry_index(int spawn, int target, bool isjet) {
+    return (spawn * N_SPAWNS + target) * 2 + isjet;
+}
+
+static void forget(struct cached_route *cr) {
+    free_course(&cr->route);
+    cr->tick = 0;
+}
+
+static inline bool usable(const struct cached_route *cr, int tick) {
+    return cr->tick == tick && cr->version == resv_version && cr->found;
+}
+
+// Plan the route for cache entry 'e' for a plane appearing next tick.
+// Returns false if there's no such route to plan.
+static bool plan_entry(int e) {
+    struct cached_route *cr = &cache[e];
+    int spawn = e / 2 / N_SPAWNS, target = e / 2 % N_SPAWNS;
+    struct xyz pos;
+    struct plane p = { .id = '.', .isjet = e % 2, .course = NULL };
+    forget(cr);
+    if (spawn == target || !spawn_point(spawn, &pos) ||
+            !target_of(target, &p.target_airport, &p.target_num))
+        return false;
+
+    const int tick = frame_no + 1;
+    add_course_elem(&p, pos.row, pos.col, pos.alt,
+                    start_bearing(pos.row, pos.col, pos.alt), false, 0);
+    p.start_tm = p.current_tm = tick;
+
+    cr->tick = tick;
+    cr->version = resv_version;
+    cr->tally = (struct plan_tally) { 0, 0, 0, 0, 0 };
+    plan_tally = &cr->tally;
+    cr->found = plan_course(&p, tick, NULL, planner) == PLAN_FOUND;
+    plan_tally = NULL;
+    if (cr->found)
+        cr->route = p;
+    else
+        free_course(&p);
+    return true;
+}
+
+// Plan one more speculative route, if any are due.  Returns whether there
+// might be more to do.
+bool precompute_step() {
+    // Wait until the exits have all been found.
+    if (!idle_planning || frame_no <= 3)
+        return false;
+    if (done_frame != frame_no) {
+        done_frame = frame_no;
+        n_done = 0;
+    }
+    while (n_done < N_ENTRIES) {
+        int e = next_entry;
+        next_entry = (next_entry + 1) % N_ENTRIES;
+        n_done++;
+        if (plan_entry(e))
+            return true;
+    }
+    return false;
+}
+
+// Give new plane 'p', whose course has just been started, its cached route
+// if there's a good one.  The route isn't reserved.
+bool adopt_route(struct plane *p) {
+    if (!idle_planning)
+        return false;
+
+    int spawn = -1, target = -1;
+    struct xyz pos;
+    for (int i = 0; spawn_point(i, &pos); i++) {
+        if (pos.row == p->course[0].pos.row &&
+                pos.col == p->course[0].pos.col &&
+                pos.alt == p->course[0].pos.alt)
+            spawn = i;
+    }
+    bool airport;
+    int num;
+    for (int i = 0; target_of(i, &airport, &num); i++) {
+        if (airport == p->target_airport && num == p->target_num)
+            target = i;
+    }
+    if (spawn < 0 || target < 0)
+        return false;
+
+    struct cached_route *cr = &cache[entry_index(spawn, target, p->isjet)];
+    if (!usable(cr, p->start_tm) || p->len != 1) {
+        n_missed++;
+        return false;
+    }
+
+    append_course(p, &cr->route.course[1], cr->route.len - 1);
+    p->end_tm = cr->route.end_tm;
+    p->slot_lo = cr->route.slot_lo;
+    count_route(cr->tally.steps, cr->tally.backtracks, cr->tally.moves,
+                cr->tally.funnel_landings > 0);
+    forget(cr);
+    n_adopted++;
+    if (verbose) {
+        fprintf(logff, "Plane '%c' adopted its precomputed route at time "
+                       "%d.\n", p->id, frame_no);
+    }
+    return true;
+}
+
+// The course entries held by the precomputed routes, out of 'n_courses'.
+int precomputed_courses() {
+    int n = 0;
+    for (int i = 0; i < N_ENTRIES; i++) {
+        if (cache[i].tick)
+            n += cache[i].route.cap;
+    }
+    return n;
+}
+
+void precompute_clear() {
+    for (int i = 0; i < N_ENTRIES; i++)
+        forget(&cache[i]);
+    next_entry = n_done = done_frame = 0;
+}
@@ -0,0 +1,376 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Replanning several planes' courses together.
+//
+// Cooperative replanning for exit and airport contention.  plot_course()
+// routes planes one at a time in the order they show up, each around the
+// courses of those before it, so when several converge on one exit the
+// latecomers get sent the long way around, even when letting them go
+// first would be better for everyone.  So when a new plane's route comes
+// out much longer than its cost-to-go, rip up the rest of the courses of
+// all the planes headed the same way and replan them closest first.  The
+// new plans are kept only if they get the last of the planes there
+// sooner, or as soon with less total flying.
+//
+// Repair of a new plane's route which runs past its fuel, or can't be
+// found at all:  Find the few planes whose courses are in the way of where
+// it would fly on an empty board, rip up the rest of their courses, and
+// replan the new plane first and them after it.
+
+#define MAX_GROUP 8
+#define CONTENTION_SLACK 4      // Moves over cost-to-go that trigger it.
+#define MAX_BLOCKERS 3
+#define FUEL 50                 // Moves a plane can fly.
+#define NEAR 2                  // Distance in each axis which "blocks".
+
+bool coop_replan = false;
+static int n_tried, n_kept;
+
+// A plane whose course after 'root_tm' is being replanned.
+struct ripup {
+    struct plane *p;
+    int root_tm;
+    int bound;                  // Lower bound on ticks from 'root_tm' on.
+    struct course *old;         // What the course was after 'root_tm'.
+    int n_old, old_end_tm;
+};
+
+static inline int imax(int a, int b) {
+    return a > b ? a : b;
+}
+
+static inline bool same_target(const struct plane *a, const struct plane *b) {
+    return a->target_airport == b->target_airport &&
+           a->target_num == b->target_num;
+}
+
+// The tick of the latest entry of an existing plane's course that's
+// already been ordered, if there's anything after it to replan, or -1.
+// Courses still being planned are left alone.
+static int replan_root(const struct plane *p) {
+    int root_tm = frame_no+1;
+    if (p->len == 0 || p->current_tm != frame_no || p->pending ||
+            last_tick(p) < root_tm+1)
+        return -1;
+    const struct course *root = course_at(p, root_tm);
+    if (root->pos.alt < 0 || root->at_exit || root[1].pos.alt < 0)
+        return -1;
+    return root_tm;
+}
+
+static void rip_up(struct ripup *r) {
+    struct plane *p = r->p;
+    r->n_old = last_tick(p) - r->root_tm;
+    r->old = NULL;
+    if (r->n_old) {
+        r->old = malloc(r->n_old * sizeof(*r->old));
+        if (r->old == NULL)
+            errexit('m', "Out of memory saving a course to replan.");
+        memcpy(r->old, course_at(p, r->root_tm+1),
+               r->n_old * sizeof(*r->old));
+    }
+    r->old_end_tm = p->end_tm;
+    resv_remove_course(p, r->root_tm+1);
+    truncate_course(p, r->root_tm);
+}
+
+static void drop_old(struct ripup *r) {
+    if (r->old)
+        free(r->old);
+    r->old = NULL;
+}
+
+// Put back the courses from before the replan.
+static void restore(struct ripup *group, int n) {
+    for (int i = 0; i < n; i++) {
+        struct ripup *r = &group[i];
+        resv_remove_course(r->p, r->root_tm+1);
+        truncate_course(r->p, r->root_tm);
+    }
+    for (int i = 0; i < n; i++) {
+        struct ripup *r = &group[i];
+        append_course(r->p, r->old, r->n_old);
+        r->p->end_tm = r->old_end_tm;
+        resv_add_course(r->p, r->root_tm+1);
+        drop_old(r);
+    }
+}
+
+// Rip up the group's courses and replan them in order.  On failure, the
+// old courses are put back.
+static bool replan_group(struct ripup *group, int n) {
+    for (int i = 0; i < n; i++)
+        rip_up(&group[i]);
+    for (int i = 0; i < n; i++) {
+        if (!extend_course(group[i].p, group[i].root_tm)) {
+            fprintf(logff, "Replan of %d planes at time %d failed on plane "
+                           "'%c'.\n", n, frame_no, group[i].p->id);
+            restore(group, n);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void commit(struct ripup *group, int n) {
+    for (int i = 0; i < n; i++)
+        drop_old(&group[i]);
+}
+
+static int boundcmp(const void *a, const void *b) {
+    const struct ripup *ra = a, *rb = b;
+    if (ra->bound != rb->bound)
+        return ra->bound - rb->bound;
+    return ra->p->id - rb->p->id;
+}
+
+// Replan 'newp' (just routed by plot_course(), and not yet ordered) along
+// with the planes it's contending with, if its route is unduly long.
+void resolve_contention(struct plane *newp) {
+    if (!coop_replan)
+        return;
+    int slack = newp->isjet ? CONTENTION_SLACK : 2*CONTENTION_SLACK;
+    int bound = tick_bound(newp, newp->course);
+    if (newp->end_tm - newp->start_tm <= bound + slack)
+        return;
+
+    struct ripup group[MAX_GROUP];
+    int n = 0;
+    group[n++] = (struct ripup) { .p = newp, .root_tm = newp->start_tm,
+                                  .bound = bound };
+    for (struct plane *p = plstart; p && n < MAX_GROUP; p = p->next) {
+        int root_tm = replan_root(p);
+        if (p == newp || !same_target(p, newp) || root_tm < 0)
+            continue;
+        group[n++] = (struct ripup) { .p = p, .root_tm = root_tm,
+                                      .bound = tick_bound(p, course_at(p,
+                                                              root_tm)) };
+    }
+    if (n < 2)
+        return;
+
+    n_tried++;
+    int old_worst = 0, old_total = 0;
+    for (int i = 0; i < n; i++) {
+        old_worst = imax(old_worst, group[i].p->end_tm);
+        old_total += group[i].p->end_tm;
+    }
+
+    qsort(group, n, sizeof(*group), boundcmp);
+    if (!replan_group(group, n))
+        return;
+    int new_worst = 0, new_total = 0;
+    for (int i = 0; i < n; i++) {
+        new_worst = imax(new_worst, group[i].p->end_tm);
+        new_total += group[i].p->end_tm;
+    }
+
+    bool keep = new_worst < old_worst ||
+                (new_worst == old_worst && new_total < old_total);
+    if (verbose || (keep && !quiet)) {
+        fprintf(logff, "Joint replan of %d planes headed for %s %d at time "
+                       "%d: last arrival %d -> %d, total %d -> %d; %s.  "
+                       "(%d of %d kept)\n",
+                n, newp->target_airport ? "airport" : "exit",
+                newp->target_num, frame_no, old_worst, new_worst, old_total,
+                new_total, keep ? "keeping" : "discarding",
+                n_kept + keep, n_tried);
+    }
+    if (!keep) {
+        restore(group, n);
+        return;
+    }
+
+    n_kept++;
+    commit(group, n);
+}
+
+// Ticks 'p' spends in the air on its course, from when it appears.
+static int airborne_ticks(const struct plane *p) {
+    int n = 0;
+    for (int i = 0; i < p->len; i++) {
+        if (p->course[i].pos.alt > 0 && !p->course[i].at_exit)
+            n++;
+    }
+    return n;
+}
+
+static bool over_fuel(const struct plane *p) {
+    return airborne_ticks(p) > (p->isjet ? FUEL : 2*FUEL);
+}
+
+// Where 'p' would fly from its start if it had the board to itself,
+// following the cost-to-go table down (or just closing the distance where
+// there's no table).  Returns the number of ticks filled in.
+static int free_route(const struct plane *p, struct xyz route[], int max) {
+    const struct course *c = p->course;
+    struct xyz pos = c->pos, target = plane_target(p);
+    int bearing = c->bearing;
+    bool cleared_exit = false;
+    int n = 0;
+
+    route[n++] = pos;
+    for (int tick = p->start_tm+1; n < max; tick++) {
+        if (pos.row == target.row && pos.col == target.col &&
+                pos.alt == target.alt)
+            break;
+        if (!p->isjet && tick%2 == 1 && pos.row != 0 && pos.col != 0 &&
+                pos.row != board_height-1 && pos.col != board_width-1) {
+            route[n++] = pos;
+            continue;
+        }
+        if (pos.alt == 0) {
+            struct xy rc = apply(pos.row, pos.col, bearing);
+            pos.row = rc.row;  pos.col = rc.col;  pos.alt = 1;
+            route[n++] = pos;
+            continue;
+        }
+
+        bool found = false;
+        int best_score = 0, best_bearing = 0;
+        struct xyz best_pos = pos;
+        for (int turn = -2; turn <= 2; turn++) {
+            int nb = (bearing + turn) & 7;
+            struct xy rc = apply(pos.row, pos.col, nb);
+            for (int nalt = pos.alt-1; nalt <= pos.alt+1; nalt++) {
+                enum move_kind mk = check_static_move(p, pos.row, pos.col,
+                                                      pos.alt, rc, nalt,
+                                                      target, cleared_exit);
+                if (mk != MOVE_OK && mk != MOVE_EXIT)
+                    continue;
+                bool ncleared = cleared_exit ||
+                                clears_exit(rc.row, rc.col, nalt);
+                int score = cost_to_go(p, rc.row, rc.col, nalt, nb,
+                                       ncleared);
+                if (score < 0) {
+                    score = imax(abs(rc.row - target.row),
+                                 imax(abs(rc.col - target.col),
+                                      abs(nalt - target.alt)));
+                }
+                if (!found || score < best_score) {
+                    found = true;
+                    best_score = score;
+                    best_bearing = nb;
+                    best_pos = (struct xyz) { rc.row, rc.col, nalt };
+                }
+            }
+        }
+        if (!found)
+            break;
+        pos = best_pos;
+        bearing = best_bearing;
+        if (clears_exit(pos.row, pos.col, pos.alt))
+            cleared_exit = true;
+        route[n++] = pos;
+    }
+    return n;
+}
+
+static inline bool near(struct xyz a, struct xyz b) {
+    return abs(a.row - b.row) <= NEAR && abs(a.col - b.col) <= NEAR &&
+           abs(a.alt - b.alt) <= NEAR;
+}
+
+// Find up to 'max' planes whose courses come near 'p's free route the
+// most often, most in the way first.
+static int find_blockers(const struct plane *p, struct plane *blockers[],
+                         int max) {
+    struct xyz route[RESV_HORIZON];
+    int len = free_route(p, route, RESV_HORIZON);
+    int counts[max];
+    int n = 0;
+
+    for (struct plane *q = plstart; q; q = q->next) {
+        if (q == p || replan_root(q) < 0)
+            continue;
+        int count = 0;
+        for (int tick = q->current_tm; tick <= last_tick(q); tick++) {
+            const struct course *c = course_at(q, tick);
+            int i = tick - p->start_tm;
+            if (i < 0 || c->at_exit || c->pos.alt < 0)
+                continue;
+            if (i >= len)
+                break;
+            if (near(c->pos, route[i]))
+                count++;
+        }
+        if (count == 0)
+            continue;
+
+        // Insert it by count, dropping the least in the way if full.
+        if (n == max && counts[n-1] >= count)
+            continue;
+        int j = n < max ? n++ : n-1;
+        for ( ; j > 0 && counts[j-1] < count; j--) {
+            counts[j] = counts[j-1];
+            blockers[j] = blockers[j-1];
+        }
+        counts[j] = count;
+        blockers[j] = q;
+    }
+    return n;
+}
+
+// Give 'newp' (just routed by plot_course(), and not yet ordered) a route
+// within its fuel, if it doesn't have one already, by replanning the
+// planes in its way after it.
+void repair_course(struct plane *newp) {
+    bool routed = newp->len > 1;
+    if (routed && !over_fuel(newp))
+        return;
+    fprintf(logff, "Plane '%c' at time %d %s; trying to replan the planes "
+                   "in its way.\n", newp->id, frame_no,
+            routed ? "would run out of fuel" : "has no route");
+
+    struct plane *blockers[MAX_BLOCKERS];
+    int n_blockers = find_blockers(newp, blockers, MAX_BLOCKERS);
+
+    // Try ripping up the one most in the way, then the two most, etc.
+    for (int k = 1; k <= n_blockers; k++) {
+        struct ripup group[MAX_BLOCKERS+1];
+        group[0] = (struct ripup) { .p = newp, .root_tm = newp->start_tm };
+        for (int i = 0; i < k; i++) {
+            int root_tm = replan_root(blockers[i]);
+            group[i+1] = (struct ripup) {
+                    .p = blockers[i], .root_tm = root_tm,
+                    .bound = tick_bound(blockers[i],
+                                        course_at(blockers[i], root_tm)) };
+        }
+        qsort(group+1, k, sizeof(*group), boundcmp);
+        if (!replan_group(group, k+1))
+            continue;
+        bool fits = true;
+        for (int i = 0; i <= k; i++)
+            fits = fits && !over_fuel(group[i].p);
+        if (!fits) {
+            restore(group, k+1);
+            continue;
+        }
+
+        commit(group, k+1);
+        if (!quiet) {
+            fprintf(logff, "Repaired the route of plane '%c' at time %d by "
+                           "replanning %d other plane(s):", newp->id,
+                    frame_no, k);
+            for (int i = 1; i <= k; i++)
+                fprintf(logff, " '%c'", group[i].p->id);
+            fputc('\n', logff);
+            log_course(newp);
+        }
+        return;
+    }
+
+    if (!routed)
+        errexit('8', "Unable to route plane %c.", newp->id);
+    fprintf(logff, "Warning: Unable to get plane '%c' a route within its "
+                   "fuel.\n", newp->id);
+    log_course(newp);
+}
@@ -0,0 +1,298 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// The reservation table:  For every tick (mod RESV_HORIZON), row, col,
+// and altitude, which plane (if any) is there according to the committed
+// courses.  No course is longer than RESV_HORIZON ticks, and entries are
+// cleared as planes move past them, so ticks in the table never alias.
+// Planes on the ground, landed, or vanishing into an exit are left out,
+// as nothing can collide with them.
+//
+// Alongside it is the load of each block of the coarse grid over each
+// window of ticks:  The count of reserved positions in it, which the
+// coarse planner takes for a block's traffic.
+
+#define N_ALT 10
+#define N_WINDOWS (RESV_HORIZON / BLOCK_WINDOW)
+
+static struct resv_cell *table;
+static int t_height, t_width;
+static unsigned short load[N_WINDOWS][BLOCK_ROWS][BLOCK_COLS];
+
+// Bumped on every change to the reservations after the current tick.
+unsigned int resv_version;
+
+static inline struct resv_cell *cell(int tick, int row, int col, int alt) {
+    return &table[(((tick & (RESV_HORIZON-1)) * t_height + row) * t_width
+                   + col) * N_ALT + alt];
+}
+
+static inline bool in_table(int row, int col, int alt) {
+    return row >= 0 && col >= 0 && row < t_height && col < t_width &&
+           alt > 0 && alt < N_ALT;
+}
+
+static inline unsigned short *load_of(int tick, int row, int col) {
+    return &load[(tick / BLOCK_WINDOW) & (N_WINDOWS-1)][row / BLOCK_SIZE]
+                [col / BLOCK_SIZE];
+}
+
+void resv_init() {
+    if (table && t_height == board_height && t_width == board_width) {
+        resv_clear();
+        return;
+    }
+    if (table)
+        free(table);
+    t_height = board_height;
+    t_width = board_width;
+    size_t size = (size_t) RESV_HORIZON * t_height * t_width * N_ALT;
+    table = malloc(size * sizeof(*table));
+    if (table == NULL)
+        errexit('m', "Out of memory allocating the reservation table.");
+    resv_clear();
+}
+
+void resv_clear() {
+    resv_version++;
+    memset(table, 0, (size_t) RESV_HORIZON * t_height * t_width * N_ALT *
+                     sizeof(*table));
+    memset(load, 0, sizeof load);
+    slots_clear();
+}
+
+static inline bool stampable(const struct course *c) {
+    return !c->at_exit && in_table(c->pos.row, c->pos.col, c->pos.alt);
+}
+
+void resv_stamp(char id, bool isjet, const struct course *c, int tick) {
+    if (!stampable(c))
+        return;
+    assert(tick - frame_no < RESV_HORIZON);
+    struct resv_cell *rc = cell(tick, c->pos.row, c->pos.col, c->pos.alt);
+    if (rc->id) {
+        fprintf(logff, "Warning: Plane '%c' at %d:(%d, %d, %d) overlaps "
+                       "plane '%c'.\n", id, tick, c->pos.row, c->pos.col,
+                c->pos.alt, rc->id);
+        return;
+    }
+    rc->id = id;
+    rc->bearing = c->bearing + 1;
+    rc->isjet = isjet;
+    (*load_of(tick, c->pos.row, c->pos.col))++;
+    if (tick > frame_no)
+        resv_version++;
+}
+
+void resv_unstamp(char id, const struct course *c, int tick) {
+    if (!stampable(c))
+        return;
+    struct resv_cell *rc = cell(tick, c->pos.row, c->pos.col, c->pos.alt);
+    if (rc->id == id) {
+        rc->id = '\0';
+        (*load_of(tick, c->pos.row, c->pos.col))--;
+        if (tick > frame_no)
+            resv_version++;
+    }
+}
+
+// The reserved positions in block (brow, bcol) over the window of ticks
+// holding 'tick'.
+int resv_block_load(int brow, int bcol, int tick) {
+    return load[(tick / BLOCK_WINDOW) & (N_WINDOWS-1)][brow][bcol];
+}
+
+// Stamp the course of 'p' from 'tick' onward.
+void resv_add_course(const struct plane *p, int tick) {
+    for ( ; tick <= last_tick(p); tick++)
+        resv_stamp(p->id, p->isjet, course_at(p, tick), tick);
+    slot_book(p);
+}
+
+void resv_remove_course(const struct plane *p, int tick) {
+    for ( ; tick <= last_tick(p); tick++)
+        resv_unstamp(p->id, course_at(p, tick), tick);
+    slot_cancel(p);
+}
+
+static inline bool pos_adjacent(int tick, struct xy rc, int alt,
+                                struct blp *rv) {
+    for (int a = alt-1; a <= alt+1; a++) {
+        for (int r = rc.row-1; r <= rc.row+1; r++) {
+            for (int c = rc.col-1; c <= rc.col+1; c++) {
+                if (!in_table(r, c, a))
+                    continue;
+                const struct resv_cell *cl = cell(tick, r, c, a);
+                if (cl->id) {
+                    rv->bearing = cl->bearing - 1;
+                    rv->alt = a;
+                    rv->isjet = cl->isjet;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+// Find a plane adjacent to (rc, alt) at 'tick'.  A prop has to stay clear
+// of the other planes for the following tick as well, since it only
+// moves every other tick.
+struct blp resv_adjacent(struct xy rc, int alt, bool imjet, int tick) {
+    struct blp rv = { -1, -1, true };
+    if (pos_adjacent(tick, rc, alt, &rv))
+        return rv;
+    if (!imjet && pos_adjacent(tick+1, rc, alt, &rv))
+        return rv;
+    return rv;
+}
+
+// Is a prop at the same flight level 2 squares away orthogonally?
+bool resv_aligned(struct xy rc, int alt, int tick) {
+    static const struct xy offs[4] = { { 0, 2 }, { 0, -2 }, { 2, 0 },
+                                       { -2, 0 } };
+    for (int i = 0; i < 4; i++) {
+        int r = rc.row + offs[i].row, c = rc.col + offs[i].col;
+        if (!in_table(r, c, alt))
+            continue;
+        const struct resv_cell *cl = cell(tick, r, c, alt);
+        if (cl->id && !cl->isjet)
+            return true;
+    }
+    return false;
+}
+
+// The planes near a square, as found in the table, a lane per plane.
+// 'later' marks those from the following tick, which count for props.
+#define NEAR_MAX 128
+struct nearby {
+    int n;
+    signed char row[NEAR_MAX], col[NEAR_MAX], alt[NEAR_MAX];
+    struct blp blp[NEAR_MAX];
+    bool later[NEAR_MAX];
+};
+
+// Add the planes at 'tick' within 3 squares and 2 altitudes of (src, alt)
+// -- all those which could be next to or aligned with a move from there --
+// in the order pos_adjacent() would come across them.
+static void gather(struct nearby *nb, int tick, bool later, struct xy src,
+                   int alt) {
+    for (int a = alt-2; a <= alt+2; a++) {
+        for (int r = src.row-3; r <= src.row+3; r++) {
+            for (int c = src.col-3; c <= src.col+3; c++) {
+                if (!in_table(r, c, a))
+                    continue;
+                const struct resv_cell *cl = cell(tick, r, c, a);
+                if (!cl->id)
+                    continue;
+                assert(nb->n < NEAR_MAX);
+                int i = nb->n++;
+                nb->row[i] = r;  nb->col[i] = c;  nb->alt[i] = a;
+                nb->blp[i] = (struct blp) { .bearing = cl->bearing - 1,
+                                            .alt = a, .isjet = cl->isjet };
+                nb->later[i] = later;
+            }
+        }
+    }
+}
+
+// The lanes of 'cb' next to (row, col, alt), and those aligned with it:
+// at the same altitude 2 squares away orthogonally.
+#ifdef __SSE2__
+static inline __m128i within1(__m128i a, __m128i b) {
+    // |a - b| <= 1 is a - b + 1 <= 2, unsigned.
+    __m128i d = _mm_add_epi8(_mm_sub_epi8(a, b), _mm_set1_epi8(1));
+    return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(2)), d);
+}
+
+static inline __m128i is_two(__m128i d) {
+    return _mm_or_si128(_mm_cmpeq_epi8(d, _mm_set1_epi8(2)),
+                        _mm_cmpeq_epi8(d, _mm_set1_epi8(-2)));
+}
+
+static inline unsigned int adjacent_lanes(const struct cand_batch *cb,
+                                          int row, int col, int alt) {
+    __m128i r = _mm_set1_epi8(row), c = _mm_set1_epi8(col);
+    __m128i a = _mm_set1_epi8(alt);
+    __m128i adj = _mm_and_si128(
+            _mm_and_si128(within1(_mm_load_si128((__m128i *) cb->row), r),
+                          within1(_mm_load_si128((__m128i *) cb->col), c)),
+            within1(_mm_load_si128((__m128i *) cb->alt), a));
+    return _mm_movemask_epi8(adj);
+}
+
+static inline unsigned int aligned_lanes(const struct cand_batch *cb,
+                                         int row, int col, int alt) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i dr = _mm_sub_epi8(_mm_load_si128((__m128i *) cb->row),
+                              _mm_set1_epi8(row));
+    __m128i dc = _mm_sub_epi8(_mm_load_si128((__m128i *) cb->col),
+                              _mm_set1_epi8(col));
+    __m128i orth = _mm_or_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(dr, zero), is_two(dc)),
+            _mm_and_si128(_mm_cmpeq_epi8(dc, zero), is_two(dr)));
+    __m128i level = _mm_cmpeq_epi8(_mm_load_si128((__m128i *) cb->alt),
+                                   _mm_set1_epi8(alt));
+    return _mm_movemask_epi8(_mm_and_si128(orth, level));
+}
+#else
+static inline unsigned int adjacent_lanes(const struct cand_batch *cb,
+                                          int row, int col, int alt) {
+    unsigned int rv = 0;
+    for (int i = 0; i < CAND_LANES; i++) {
+        if (abs(cb->row[i] - row) <= 1 && abs(cb->col[i] - col) <= 1 &&
+                abs(cb->alt[i] - alt) <= 1)
+            rv |= 1u << i;
+    }
+    return rv;
+}
+
+static inline unsigned int aligned_lanes(const struct cand_batch *cb,
+                                         int row, int col, int alt) {
+    unsigned int rv = 0;
+    for (int i = 0; i < CAND_LANES; i++) {
+        int dr = cb->row[i] - row, dc = cb->col[i] - col;
+        if (cb->alt[i] == alt && ((dr == 0 && abs(dc) == 2) ||
+                                  (dc == 0 && abs(dr) == 2)))
+            rv |= 1u << i;
+    }
+    return rv;
+}
+#endif
+
+// Check the first 'n' candidate moves in 'cb', from (src, alt), against
+// the reserved courses at 'tick' all at once:  As resv_adjacent() and
+// resv_aligned() (for a jet) for each, giving lane masks of those blocked
+// and aligned, and the plane resv_adjacent() would give for each blocked.
+void resv_check_moves(const struct cand_batch *cb, int n, struct xy src,
+                      int alt, bool imjet, int tick, struct move_checks *mc) {
+    struct nearby nb = { .n = 0 };
+    gather(&nb, tick, false, src, alt);
+    if (!imjet)
+        gather(&nb, tick+1, true, src, alt);
+
+    const unsigned int lanes = (1u << n) - 1;
+    mc->blocked = mc->aligned = 0;
+    for (int j = 0; j < nb.n; j++) {
+        unsigned int adj = adjacent_lanes(cb, nb.row[j], nb.col[j],
+                                          nb.alt[j]) & lanes;
+        for (unsigned int fresh = adj & ~mc->blocked; fresh;
+                fresh &= fresh - 1)
+            mc->blocker[__builtin_ctz(fresh)] = nb.blp[j];
+        mc->blocked |= adj;
+        if (imjet && !nb.later[j] && !nb.blp[j].isjet) {
+            mc->aligned |= aligned_lanes(cb, nb.row[j], nb.col[j],
+                                         nb.alt[j]) & lanes;
+        }
+    }
+}
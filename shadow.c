@@ -0,0 +1,237 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Shadow planning ("-A <planner>"):  To see how another planner would do
+// on real traffic before switching to it, each new plane is also routed
+// by it, on a copy, with nothing reserved and nothing typed.  That's done
+// while the main loop's idle, after the tick's planning:  Both the
+// production planner ("-R") and the shadow one replay the plane from where
+// it appeared, against the same reservations, with as long as they take,
+// and each plane's route lengths, search steps and times go to the stats
+// file ("-O"), one line apiece, along with whether the two agree, and
+// whether the production replay is the route the plane's flying.  Their
+// routes are tallied apart from the game's totals.
+//
+// By the time the replays run, the plane's own course is committed, and
+// left in the table they'd route around it.  So it's taken out while they
+// run and put back after, leaving the table (and resv_version) as it was.
+// The reservations they see still include the routes of the planes
+// planned after this one in its tick, which the production search didn't,
+// so the production replay can differ from the route the plane flies.
+// Both replays see the same table, though.  A snapshot not replayed by
+// the next tick is dropped, as the table's moved on.
+
+bool shadow_mode = false;
+enum planner_kind shadow_planner;
+const char *shadow_file_name = "atc-ai.shadow";
+int n_shadowed, n_shadow_stale, n_shadow_disagreements, n_shadow_drifted;
+
+static const char *const planner_names[] = {
+    [PLANNER_GREEDY] = "greedy", [PLANNER_ASTAR] = "astar",
+    [PLANNER_BIDIR] = "bidir", [PLANNER_HIER] = "hier",
+    [PLANNER_PORTFOLIO] = "portfolio",
+};
+
+// A new plane, as it appeared.
+struct snapshot {
+    char id;
+    bool isjet, target_airport;
+    int target_num;
+    struct course start;
+    int tick;
+};
+
+#define QUEUE_MAX 52            // A plane for every letter.
+static struct snapshot queue[QUEUE_MAX];
+static int n_queued;
+static FILE *shadowff;
+
+// What each planner's replays come to, over the game.
+static struct {
+    int found;
+    long steps;
+    double us, longest_us;
+} totals[2];
+
+// A replay of a snapshot by one planner.
+struct replay {
+    struct plane q;
+    bool found;
+    long steps;
+    double us;
+};
+
+// Queue new plane 'p', whose course has just been started, for replaying.
+void shadow_note(const struct plane *p) {
+    if (!shadow_mode || n_queued == QUEUE_MAX)
+        return;
+    queue[n_queued++] = (struct snapshot) {
+        .id = p->id, .isjet = p->isjet, .target_airport = p->target_airport,
+        .target_num = p->target_num, .start = p->course[0],
+        .tick = p->start_tm };
+}
+
+static double us_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e6 +
+           (now.tv_nsec - start->tv_nsec) / 1e3;
+}
+
+// Route a copy of the plane in 'sn' with planner 'kind' into 'rp'.
+static void replay(const struct snapshot *sn, enum planner_kind kind,
+                   struct replay *rp) {
+    rp->q = (struct plane) { .id = sn->id, .isjet = sn->isjet,
+                             .target_airport = sn->target_airport,
+                             .target_num = sn->target_num, .course = NULL,
+                             .len = 0, .cap = 0, .pending = false,
+                             .prev = NULL, .next = NULL };
+    append_course(&rp->q, &sn->start, 1);
+    rp->q.start_tm = rp->q.current_tm = sn->tick;
+
+    struct plan_tally tally = { 0, 0, 0, 0, 0 };
+    struct timespec start;
+    plan_tally = &tally;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    rp->found = plan_course(&rp->q, sn->tick, NULL, kind) == PLAN_FOUND;
+    rp->us = us_since(&start);
+    plan_tally = NULL;
+    rp->steps = tally.steps;
+}
+
+// Do courses 'a' and 'b', of the same length, go the same way?
+static bool same_route(const struct plane *a, const struct plane *b) {
+    for (int i = 0; i < a->len; i++) {
+        const struct xyz pa = a->course[i].pos, pb = b->course[i].pos;
+        if (pa.row != pb.row || pa.col != pb.col || pa.alt != pb.alt)
+            return false;
+    }
+    return true;
+}
+
+// How the two replays' routes compare.
+static const char *verdict(const struct replay *a, const struct replay *b) {
+    if (a->found != b->found)
+        return "found";
+    if (!a->found)
+        return "none";
+    if (a->q.len != b->q.len)
+        return "length";
+    return same_route(&a->q, &b->q) ? "same" : "route";
+}
+
+// The plane the snapshot is of, if it's still on the board.
+static struct plane *live_plane(const struct snapshot *sn) {
+    for (struct plane *p = plstart; p; p = p->next) {
+        if (p->id == sn->id && p->start_tm == sn->tick)
+            return p;
+    }
+    return NULL;
+}
+
+// Take 'p's course from its current tick on out of the table, or put it
+// back.
+static void stamp_own(const struct plane *p, bool on) {
+    for (int tick = p->current_tm; tick <= last_tick(p); tick++) {
+        if (on)
+            resv_stamp(p->id, p->isjet, course_at(p, tick), tick);
+        else
+            resv_unstamp(p->id, course_at(p, tick), tick);
+    }
+}
+
+static void open_stats() {
+    shadowff = fopen(shadow_file_name, "w");
+    if (shadowff == NULL) {
+        errexit('A', "Unable to open the shadow stats file \"%s\": %s",
+                shadow_file_name, strerror(errno));
+    }
+    setvbuf(shadowff, NULL, _IOLBF, 0);
+    fprintf(shadowff, "# tick plane %s:length,steps,us %s:length,steps,us "
+                      "verdict flown\n", planner_names[planner],
+            planner_names[shadow_planner]);
+}
+
+static void shadow_plane(const struct snapshot *sn) {
+    const struct plane *p = live_plane(sn);
+    const unsigned int version = resv_version;
+    if (p)
+        stamp_own(p, false);
+    struct replay rp[2];
+    replay(sn, planner, &rp[0]);
+    replay(sn, shadow_planner, &rp[1]);
+    if (p)
+        stamp_own(p, true);
+    resv_version = version;
+    const char *v = verdict(&rp[0], &rp[1]);
+    const char *flown = "-";
+    if (p) {
+        flown = rp[0].found && rp[0].q.len == p->len &&
+                same_route(&rp[0].q, p) ? "same" : "differs";
+        if (*flown == 'd')
+            n_shadow_drifted++;
+    }
+
+    n_shadowed++;
+    if (strcmp(v, "same") && strcmp(v, "none"))
+        n_shadow_disagreements++;
+    for (int i = 0; i < 2; i++) {
+        totals[i].found += rp[i].found;
+        totals[i].steps += rp[i].steps;
+        totals[i].us += rp[i].us;
+        if (rp[i].us > totals[i].longest_us)
+            totals[i].longest_us = rp[i].us;
+    }
+    if (shadowff == NULL)
+        open_stats();
+    fprintf(shadowff, "%d %c %d,%ld,%.0f %d,%ld,%.0f %s %s\n", sn->tick,
+            sn->id, rp[0].found ? rp[0].q.len - 1 : -1, rp[0].steps,
+            rp[0].us, rp[1].found ? rp[1].q.len - 1 : -1, rp[1].steps,
+            rp[1].us, v, flown);
+    if (verbose && strcmp(v, "same")) {
+        fprintf(logff, "Shadow planner %s and %s differ on plane '%c' at "
+                       "time %d: %s.\n", planner_names[planner],
+                planner_names[shadow_planner], sn->id, sn->tick, v);
+    }
+    free_course(&rp[0].q);
+    free_course(&rp[1].q);
+}
+
+// Replay the next queued plane, if there is one.  Returns whether it did.
+bool shadow_step() {
+    while (n_queued > 0) {
+        const struct snapshot sn = queue[--n_queued];
+        if (sn.tick != frame_no) {
+            n_shadow_stale++;
+            continue;
+        }
+        shadow_plane(&sn);
+        return true;
+    }
+    return false;
+}
+
+void log_shadow() {
+    fprintf(logff, "Shadow planner %s against %s: %d planes replayed, %d "
+                   "disagreements, %d dropped; %d production replays "
+                   "differ from the route flown.\n",
+            planner_names[shadow_planner], planner_names[planner],
+            n_shadowed, n_shadow_disagreements, n_shadow_stale,
+            n_shadow_drifted);
+    for (int i = 0; i < 2; i++) {
+        const int n = n_shadowed ? n_shadowed : 1;
+        fprintf(logff, "Shadow replays by %s: %d routed; %.1f steps, "
+                       "%.1f us mean; %.1f us longest.\n",
+                planner_names[i ? shadow_planner : planner],
+                totals[i].found, (double) totals[i].steps / n,
+                totals[i].us / n, totals[i].longest_us);
+    }
+}
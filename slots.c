@@ -0,0 +1,143 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <assert.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Arrival slots:  For each exit and airport, the ticks at which the planes
+// with committed courses get there (to the exit, or to the square they
+// land from).  No two planes may arrive at the same place on the same
+// tick, which for exits the reservation table can't tell, as planes
+// vanish into them.  Before a plane is routed, it's given the first free
+// slot at or after the soonest it could get there.  That's only a lower
+// bound, which A* uses:  A course may arrive at any free slot after it,
+// and the slot it arrives at is booked once the course is committed.  The tables follow resv_add_course() and
+// resv_remove_course(), so they always match the committed courses.
+
+#define N_TARGETS (EXIT_MAX + AIRPORT_MAX)
+#define MAX_SLOTS 52            // One per plane.
+#define SLOT_SLACK 4            // Ticks after its earliest slot it's "late".
+
+struct slot {
+    int tick;
+    char id;
+};
+
+struct slot_table {
+    int n;
+    struct slot slots[MAX_SLOTS];       // In order of tick.
+    int n_booked, n_late, max_queue;
+};
+
+static struct slot_table tables[N_TARGETS];
+
+static inline struct slot_table *table_of(const struct plane *p) {
+    return &tables[p->target_airport * EXIT_MAX + p->target_num];
+}
+
+void slots_clear() {
+    for (int i = 0; i < N_TARGETS; i++)
+        tables[i] = (struct slot_table) { .n = 0 };
+}
+
+bool slot_free(const struct plane *p, int tick) {
+    const struct slot_table *t = table_of(p);
+    for (int i = 0; i < t->n && t->slots[i].tick <= tick; i++) {
+        if (t->slots[i].tick == tick && t->slots[i].id != p->id)
+            return false;
+    }
+    return true;
+}
+
+// Give 'p' the first free slot from tick 'earliest' on.
+void slot_earliest(struct plane *p, int earliest) {
+    int tick = earliest;
+    while (!slot_free(p, tick))
+        tick++;
+    p->slot_lo = tick;
+}
+
+// The tick 'p's committed course gets it to its target, or -1 if it
+// doesn't.
+static int arrival(const struct plane *p) {
+    if (p->len == 0)
+        return -1;
+    const struct course *end = course_end(p);
+    if (end->at_exit)
+        return last_tick(p);
+    if (end->pos.alt != -2)
+        return -1;
+    // Back up over the landing, and a prop's wait before it.
+    int tick = last_tick(p) - 1;
+    struct xyz target = plane_target(p);
+    while (tick > p->start_tm &&
+           course_at(p, tick-1)->pos.row == target.row &&
+           course_at(p, tick-1)->pos.col == target.col &&
+           course_at(p, tick-1)->pos.alt == target.alt)
+        tick--;
+    return tick;
+}
+
+void slot_cancel(const struct plane *p) {
+    struct slot_table *t = table_of(p);
+    for (int i = 0; i < t->n; i++) {
+        if (t->slots[i].id == p->id) {
+            t->n--;
+            for ( ; i < t->n; i++)
+                t->slots[i] = t->slots[i+1];
+            return;
+        }
+    }
+}
+
+void slot_book(const struct plane *p) {
+    int tick = arrival(p);
+    if (tick < 0)
+        return;
+    slot_cancel(p);
+    struct slot_table *t = table_of(p);
+    assert(t->n < MAX_SLOTS);
+
+    int queue = 0;
+    int i = t->n;
+    for ( ; i > 0 && t->slots[i-1].tick > tick; i--)
+        t->slots[i] = t->slots[i-1];
+    t->slots[i] = (struct slot) { .tick = tick, .id = p->id };
+    t->n++;
+    for (int j = 0; j < i; j++) {
+        if (t->slots[j].tick >= frame_no)
+            queue++;
+    }
+
+    t->n_booked++;
+    bool late = p->slot_lo &&
+                tick > p->slot_lo + (p->isjet ? SLOT_SLACK : 2*SLOT_SLACK);
+    if (late)
+        t->n_late++;
+    if (queue > t->max_queue)
+        t->max_queue = queue;
+    if (verbose) {
+        fprintf(logff, "Plane '%c' booked %s %d at tick %d (earliest %d), "
+                       "behind %d.\n", p->id,
+                p->target_airport ? "airport" : "exit", p->target_num,
+                tick, p->slot_lo, queue);
+    }
+}
+
+// Log the slots booked at each exit and airport, and how busy they've been.
+void log_slots() {
+    for (int i = 0; i < N_TARGETS; i++) {
+        const struct slot_table *t = &tables[i];
+        if (t->n_booked == 0)
+            continue;
+        fprintf(logff, "Slots at %s %d: booked %d, late %d, longest queue "
+                       "%d; now", i < EXIT_MAX ? "exit" : "airport",
+                i % EXIT_MAX, t->n_booked, t->n_late, t->max_queue);
+        for (int j = 0; j < t->n; j++)
+            fprintf(logff, " '%c'@%d", t->slots[j].id, t->slots[j].tick);
+        fputc('\n', logff);
+    }
+}
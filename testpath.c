@@ -4,11 +4,29 @@
 
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
 #include "atc-ai.h"
 #include "pathfind.h"
 
-static void check_course(struct course *c, struct xyz *excr, int exlen,
+static void check_course(const struct plane *p, struct xyz *excr, int exlen,
                          bool isprop);
+static void check_clear(struct plane *p);
+
+static inline bool xyz_eq(struct xyz a, struct xyz b) {
+    return a.row == b.row && a.col == b.col && a.alt == b.alt;
+}
+
+// Reserve a plane's position 'c' for ticks 't0' through 't1'.
+static void reserve(char id, bool isjet, const struct course *c,
+                    int t0, int t1) {
+    for (int t = t0; t <= t1; t++)
+        resv_stamp(id, isjet, c, t);
+}
+
+static void unreserve(char id, const struct course *c, int t0, int t1) {
+    for (int t = t0; t <= t1; t++)
+        resv_unstamp(id, c, t);
+}
 
 
 // Verify the behavior of 'calc_next_move':
@@ -18,7 +36,7 @@ static void check_course(struct course *c, struct xyz *excr, int exlen,
 
 static void test_blocked() {
     struct plane pl = { .id = 't', .isjet = true, .target_airport = false,
-                        .target_num = 0, .start = NULL, .end = NULL,
+                        .target_num = 0, .course = NULL, .len = 0,
                         .start_tm = -1, .end_tm = -1,
                         .prev = NULL, .next = NULL };
     int alt = 6;
@@ -27,27 +45,29 @@ static void test_blocked() {
     struct xy rc = { .row = 5, .col = 5 };
     // c1: NW/W/SW blocked.
     struct course c1 = { .pos = { .row = 5, .col = 3, .alt = alt },
-                         .bearing = -1, .next = &c1, .prev = &c1 };
+                         .bearing = -1 };
     // c2: W/NW/N/NE/E blocked.
     struct course c2 = { .pos = { .row = 4, .col = 5, .alt = alt },
-                         .bearing = -1, .next = &c2, .prev = &c2 };
-    struct op_courses op = { .c = &c2, .isjet = false,
-                             .prev = NULL, .next = NULL };
-    struct frame fr = { .opc_start = &op, .prev = NULL, .next = NULL };
+                         .bearing = -1 };
+    reserve('x', false, &c2, 1, 2);
+    struct traffic_view view = { .tick0 = 1 };
+    struct frame fr = { .depth = 0 };
+    int n = n_malloc;
 
     // Test all moves blocked (c2)
     calc_next_move(&pl, rc.row, rc.col, &alt, target, &bearing,
-                   false, &fr);
+                   false, &view, &fr);
     assert(fr.n_cand == 0);
     assert(alt < 0);
 
     alt = 6;
     bearing = bearing_of("N");
-    op.c = &c1;
+    unreserve('x', &c2, 1, 2);
+    reserve('x', false, &c1, 1, 2);
 
     // Test moves to the west blocked (c1)
     calc_next_move(&pl, rc.row, rc.col, &alt, target, &bearing,
-                   false, &fr);
+                   false, &view, &fr);
 
     assert(fr.n_cand == 9);
     for (int i = fr.n_cand-1; i >= 0; i--) {
@@ -78,8 +98,9 @@ static void test_blocked() {
     }
     assert(n_checks == 6);
 
-    assert(n_malloc == 0);
+    assert(n_malloc == n);
     assert(n_free == 0);
+    resv_clear();
 }
 
 
@@ -87,11 +108,11 @@ static void test_blocked() {
 // west prevents a jet ('j') at (1, 9, 9) from going west.
 static void test_matchcourse() {
     struct plane pi = { .id = 'i', .isjet = true, .target_airport = false,
-                        .target_num = 0, .start = NULL, .end = NULL,
+                        .target_num = 0, .course = NULL, .len = 0,
                         .start_tm = -1, .end_tm = -1,
                         .prev = NULL, .next = NULL };
     struct plane pj = { .id = 'j', .isjet = true, .target_airport = false,
-                        .target_num = 1, .start = NULL, .end = NULL,
+                        .target_num = 1, .course = NULL, .len = 0,
                         .start_tm = -1, .end_tm = -1,
                         .prev = NULL, .next = NULL };
     plstart = plend = &pi;
@@ -99,23 +120,18 @@ static void test_matchcourse() {
     int bearing = bearing_of("W");
     struct xy rc = { .row = 1, .col = 9 };
     int jalt = 9;
-    struct course c1 = { .pos = { .row = 1, .col = 11, .alt = 9 },
-                         .bearing = bearing, .prev = NULL,
-                         .at_exit = false };
-    struct course c2 = { .pos = { .row = 1, .col = 10, .alt = 9 },
-                         .bearing = bearing, .prev = &c1,
-                         .at_exit = false };
-    struct course c3 = { .pos = { .row = 1, .col = 9, .alt = 9 },
-                         .bearing = bearing, .next = NULL, .prev = &c2,
-                         .at_exit = false };
-    c1.next = &c2;
-    c2.next = &c3;
-    pi.start = &c1;  pi.end = &c3;
-    struct op_courses op = { .c = &c2, .isjet = true,
-                             .prev = NULL, .next = NULL };
-    struct frame fr = { .opc_start = &op, .prev = NULL, .next = NULL };
-
-    calc_next_move(&pj, rc.row, rc.col, &jalt, target, &bearing, true, &fr);
+    struct course ci[3] = {
+        { .pos = { .row = 1, .col = 11, .alt = 9 }, .bearing = bearing },
+        { .pos = { .row = 1, .col = 10, .alt = 9 }, .bearing = bearing },
+        { .pos = { .row = 1, .col = 9, .alt = 9 }, .bearing = bearing },
+    };
+    pi.course = ci;  pi.len = 3;
+    reserve('i', true, &ci[1], 1, 1);
+    struct traffic_view view = { .tick0 = 1 };
+    struct frame fr = { .depth = 0 };
+
+    calc_next_move(&pj, rc.row, rc.col, &jalt, target, &bearing, true,
+                   &view, &fr);
     assert(fr.n_cand > 0);
     fprintf(logff, "Matchcourse test plane: Bearing %s\n",
             bearings[bearing].longname);
@@ -124,22 +140,1328 @@ static void test_matchcourse() {
     struct step s1 = fr.cand[fr.n_cand-1];
     assert(s1.bearing == bearing_of("SW"));
     assert(s1.alt == 9);
+    resv_clear();
+}
+
+// Verify the search arena hands out separate blocks, bigger than a chunk
+// too, and that a reset reuses the same memory rather than getting more.
+static void test_arena() {
+    struct arena a = { .head = NULL };
+    void *p1 = arena_alloc(&a, 10);
+    void *p2 = arena_alloc(&a, 100);
+    assert(p2 != p1);
+    void *big = arena_alloc(&a, 100000);   // Bigger than a chunk.
+    assert(big);
+    size_t hw = a.hiwater;
+    arena_reset(&a);
+    assert(a.in_use == 0);
+    int n = n_malloc;
+    assert(arena_alloc(&a, 10) == p1);
+    arena_alloc(&a, 100000);
+    assert(n_malloc == n);
+    assert(a.hiwater == hw);
+}
+
+// Verify the cell table knows the boundary, the exits, and an airport's
+// exclusion zone, and that exits and airports are found by number.
+static void test_cells() {
+    board_width = board_height = 10;
+    n_airports = 1;
+    airports[0] = (struct airport) { .num = 3, .row = 5, .col = 5,
+                                     .bearing = bearing_of("E") };
+    for (int i = 0; i < EZ_SIZE; i++)
+        airports[0].exc[i] = (struct xy) { .row = 5, .col = 5 };
+    n_exits = 1;
+    exits[0] = (struct exitspec) { .num = 7, .row = 0, .col = 4 };
+    cells_init();
+    cells_add_exit(&exits[0]);
+
+    assert(get_airport(3) == &airports[0] && get_airport(0) == NULL);
+    assert(get_exit(7) == &exits[0] && get_exit(0) == NULL);
+    assert(get_airport_xy(5, 5) == &airports[0] && !get_airport_xy(5, 6));
+    assert(is_exit_at(0, 4) && !is_exit_at(0, 5) && !is_exit_at(-1, 4));
+    assert(cells[0][4].flags & CELL_BOUNDARY);
+    assert(!(cells[1][4].flags & CELL_BOUNDARY));
+    assert(cells[2][4].flags & CELL_EDGE_BAND);
+    assert(!(cells[3][4].flags & CELL_EDGE_BAND));
+    // New planes fly south from the exit, into its corridor.
+    assert((cells[1][4].flags & CELL_CORRIDOR) &&
+           (cells[5][3].flags & CELL_CORRIDOR) &&
+           (cells[5][5].flags & CELL_CORRIDOR));
+    assert(!(cells[6][4].flags & CELL_CORRIDOR) &&
+           !(cells[3][6].flags & CELL_CORRIDOR) &&
+           !(cells[0][4].flags & CELL_CORRIDOR));
+    // An east-facing airport excludes the squares to its east.
+    assert(cells[5][5].excl == 1u << 3 && cells[2][8].excl == 1u << 3);
+    assert(cells[5][4].excl == 0);
+    n_airports = n_exits = 0;
+    cells_init();
+}
+
+// Verify trace selections parse into what they say, and that a bad one
+// leaves the selection as it was.
+static void test_trace() {
+    assert(set_trace("i:575"));
+    assert(trace_sel.on && trace_sel.id == 'i' &&
+           trace_sel.from == 575 && trace_sel.to == 575);
+    assert(set_trace("*:100-200:0,0-4,29"));
+    assert(!set_trace("i:x") && !set_trace("i:5:1") && !set_trace("ij"));
+    assert(trace_sel.on && trace_sel.id == '\0' &&
+           trace_sel.from == 100 && trace_sel.to == 200 &&
+           trace_sel.row0 == 0 && trace_sel.col0 == 0 &&
+           trace_sel.row1 == 4 && trace_sel.col1 == 29);
+#ifndef NO_TRACE
+    struct plane j = { .id = 'j' };
+    assert(tracing(&j, 4, 29, 100) && tracing(&j, 0, 0, 200));
+    assert(!tracing(&j, 5, 3, 150) && !tracing(&j, 4, 30, 150));
+    assert(!tracing(&j, 2, 2, 99) && !tracing(&j, 2, 2, 201));
+    assert(set_trace("i"));
+    assert(!tracing(&j, 2, 2, 150));
+#endif
+    assert(set_trace(""));
+    assert(!trace_sel.on);
+}
+
+// Verify the weights parse and print back, and that a bad one's refused.
+static void test_heuristics() {
+    const struct heuristics orig = heur;
+    char buf[256];
+    assert(set_heuristics("matchcourse=500,detour=3"));
+    assert(heur.matchcourse_penalty == 500 && heur.detour_weight == 3 &&
+           heur.changealt_bonus == orig.changealt_bonus);
+    format_heuristics(buf, sizeof buf);
+    heur = orig;
+    assert(set_heuristics(buf));
+    assert(heur.matchcourse_penalty == 500 && heur.detour_weight == 3);
+    assert(!set_heuristics("aligned_div=0") && !set_heuristics("bogus=1"));
+    assert(!set_heuristics("detour") && !set_heuristics("detour=2;"));
+    heur = orig;
+}
+
+// Verify the reservation table only reports planes at the ticks they're
+// there (and the tick after, for props), and forgets them once removed.
+static void test_resv() {
+    board_width = board_height = 10;
+    resv_init();
+    struct course c = { .pos = { .row = 5, .col = 5, .alt = 5 },
+                        .bearing = bearing_of("E"), .at_exit = false };
+    struct xy near = { .row = 6, .col = 4 }, far = { .row = 7, .col = 5 };
+    struct xy inline_ = { .row = 5, .col = 7 };
+    resv_stamp('P', false, &c, 5);
+
+    struct blp b = resv_adjacent(near, 6, true, 5);
+    assert(b.alt == 5 && b.bearing == bearing_of("E") && !b.isjet);
+    assert(resv_adjacent(near, 7, true, 5).alt < 0);
+    assert(resv_adjacent(far, 5, true, 5).alt < 0);
+    assert(resv_adjacent(near, 5, true, 4).alt < 0);
+    assert(resv_adjacent(near, 5, false, 4).alt == 5);
+    assert(resv_adjacent(near, 5, true, 5 + RESV_HORIZON/2).alt < 0);
+    assert(resv_aligned(inline_, 5, 5));
+    assert(!resv_aligned(inline_, 4, 5));
+
+    resv_unstamp('P', &c, 5);
+    assert(resv_adjacent(near, 5, false, 4).alt < 0);
+    assert(!resv_aligned(inline_, 5, 5));
+}
+
+// Verify checking a plane's moves against the reservations all at once
+// agrees with checking them one by one, about scattered planes.
+static void test_check_moves() {
+    board_width = board_height = 12;
+    resv_init();
+    srand(12345);
+    for (int round = 0; round < 200; round++) {
+        const int tick = 10 + round % 2;
+        struct course cs[12];
+        for (int i = 0; i < 12; i++) {
+            cs[i] = (struct course) { .pos = { .row = rand() % 12,
+                                               .col = rand() % 12,
+                                               .alt = 1 + rand() % 9 },
+                                      .bearing = rand() % 8 };
+            resv_stamp('a' + i, rand() % 2, &cs[i], tick + rand() % 2);
+        }
+        struct xy src = { .row = rand() % 12, .col = rand() % 12 };
+        const int alt = 1 + rand() % 9, bearing = rand() % 8;
+        struct cand_batch cb;
+        for (int i = 0; i < 15; i++) {
+            struct xy rc = apply(src.row, src.col, (bearing + i/3 - 2) & 7);
+            cb.row[i] = rc.row;  cb.col[i] = rc.col;
+            cb.alt[i] = alt + i%3 - 1;
+        }
+        for (int isjet = 0; isjet < 2; isjet++) {
+            struct move_checks mc;
+            resv_check_moves(&cb, 15, src, alt, isjet, tick, &mc);
+            for (int i = 0; i < 15; i++) {
+                struct xy rc = { .row = cb.row[i], .col = cb.col[i] };
+                struct blp b = resv_adjacent(rc, cb.alt[i], isjet, tick);
+                assert(!!(mc.blocked & 1u << i) == (b.alt > 0));
+                if (b.alt > 0) {
+                    assert(mc.blocker[i].alt == b.alt &&
+                           mc.blocker[i].bearing == b.bearing &&
+                           mc.blocker[i].isjet == b.isjet);
+                }
+                assert(!!(mc.aligned & 1u << i) ==
+                       (isjet && resv_aligned(rc, cb.alt[i], tick)));
+            }
+        }
+        resv_clear();
+    }
+}
+
+// Verify the cost-to-go tables:  Exact on open sky, knowing a plane has
+// to turn around, and that an exit-bound plane can't get down into the
+// band along the edge once it's left it.
+static void test_costmap() {
+    board_width = board_height = 10;
+    resv_init();
+    n_airports = 0;
+    n_exits = 1;
+    exits[0].num = 1;  exits[0].row = 0;  exits[0].col = 4;
+    cells_init();
+    cells_add_exit(&exits[0]);
+    costmap_init();
+    costmap_add_exit(&exits[0]);
+
+    struct plane pl = { .id = 'x', .isjet = true, .target_airport = false,
+                        .target_num = 1, .course = NULL, .len = 0,
+                        .prev = NULL, .next = NULL };
+    const int N = bearing_of("N"), S = bearing_of("S");
+    assert(cost_to_go(&pl, 0, 4, 9, S, true) == 0);
+    assert(cost_to_go(&pl, 5, 4, 9, N, true) == 5);
+    assert(cost_to_go(&pl, 5, 4, 7, N, true) == 5);
+    int turn = cost_to_go(&pl, 1, 4, 9, S, true);
+    assert(turn > 2 && turn < CTG_INF);
+    assert(cost_to_go(&pl, 1, 1, 5, bearing_of("NW"), true) == CTG_INF);
+    assert(cost_to_go(&pl, 1, 1, 0, N, true) == -1);
+
+    // The greedy search should take the quicker way around.
+    int alt = 9, bearing = S;
+    struct traffic_view view = { .tick0 = 2 };
+    struct frame fr = { .depth = 0, .n_cand = 0 };
+    calc_next_move(&pl, 1, 4, &alt, plane_target(&pl), &bearing, true, &view,
+                   &fr);
+    struct xy rc = apply(1, 4, bearing);
+    assert(cost_to_go(&pl, rc.row, rc.col, alt, bearing, true) == turn-1);
+
+    costmap_clear();
+    assert(cost_to_go(&pl, 5, 4, 9, N, true) == -1);
+    n_exits = 0;
+}
+
+// A board with exit 0 at the top and exit 1 at the left, where plane 'a'
+// sits just short of exit 0 until tick 'until'.
+static void hovering_plane(struct plane *a, int until) {
+    board_width = 16;  board_height = 12;
+    resv_init();
+    n_airports = 0;
+    n_exits = 2;
+    exits[0] = (struct exitspec) { .num = 0, .row = 0, .col = 8 };
+    exits[1] = (struct exitspec) { .num = 1, .row = 6, .col = 0 };
+    cells_init();
+    costmap_init();
+    for (int i = 0; i < n_exits; i++) {
+        cells_add_exit(&exits[i]);
+        costmap_add_exit(&exits[i]);
+    }
+    frame_no = 1;
+
+    *a = (struct plane) { .id = 'a', .isjet = true, .target_airport = false,
+                          .target_num = 0, .course = NULL, .len = 0,
+                          .prev = NULL, .next = NULL };
+    for (int t = 1; t < until; t++)
+        add_course_elem(a, 1, 8, 9, bearing_of("N"), true, 0);
+    add_course_elem(a, 0, 8, 9, bearing_of("N"), true, 0);
+    course_end(a)->at_exit = true;
+    a->start_tm = a->current_tm = 1;
+    a->end_tm = until;
+    resv_add_course(a, 1);
+    plstart = plend = a;
+}
+
+// Reserve (or with 'un', unreserve) planes at every altitude down column
+// 'col' from row 'r0' to 'r1', for ticks 1 through 't1'.
+static void wall(int col, int r0, int r1, int t1, bool un) {
+    for (int row = r0; row <= r1; row++) {
+        for (int alt = 2; alt <= 8; alt += 3) {
+            const struct course c = { .pos = { row, col, alt }, .bearing = 0 };
+            if (un)
+                unreserve('W', &c, 1, t1);
+            else
+                reserve('W', true, &c, 1, t1);
+        }
+    }
+}
+
+// A plane 'id' new to hovering_plane()'s board, bound for exit
+// 'target_num', its course not yet begun.
+static struct plane new_plane(char id, bool isjet, int target_num) {
+    return (struct plane) { .id = id, .isjet = isjet,
+                            .target_airport = false, .target_num = target_num,
+                            .course = NULL, .len = 0, .prev = NULL,
+                            .next = NULL };
+}
+
+// Hand back hovering plane 'a', checking it's clear of the rest, and that
+// the courses are back to the 'n' there were before.
+static void done_hovering(struct plane *a, int n) {
+    check_clear(a);
+    assert(n_courses == n);
+    plstart = plend = NULL;
+    costmap_clear();
+    n_exits = 0;
+}
+
+// Verify a new plane held up behind one hanging about the exit gets
+// replanned along with it, and that the courses and reservations are
+// all handed back afterward.
+static void test_contention() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 21);
+    struct plane b = new_plane('b', true, 0);
+    coop_replan = false;
+    assert(plot_course(&b, 6, 0, 7));
+    resolve_contention(&b);
+    assert(b.end_tm > 21);
+    resv_remove_course(&b, b.start_tm);
+    free_course(&b);
+
+    coop_replan = true;
+    assert(plot_course(&b, 6, 0, 7));
+    resolve_contention(&b);
+    assert(a.end_tm < 5 && course_end(&a)->at_exit);
+    assert(b.end_tm < 21 && course_end(&b)->at_exit);
+    assert(course_at(&a, a.current_tm+1)->pos.row == 1 &&
+           course_at(&a, a.current_tm+1)->pos.col == 8);
+    check_clear(&b);
+    coop_replan = false;
+    done_hovering(&a, n);
+}
+
+// Verify a new plane that would run out of fuel waiting on one hanging
+// about the exit gets it moved out of the way.
+static void test_repair() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 80);
+    struct plane b = new_plane('b', true, 0);
+    plot_course(&b, 6, 0, 7);
+    assert(b.end_tm > 80 && a.end_tm == 80);
+    repair_course(&b);
+    assert(b.end_tm - b.start_tm <= 50 && course_end(&b)->at_exit);
+    assert(a.end_tm < 5 && course_end(&a)->at_exit);
+    check_clear(&b);
+    done_hovering(&a, n);
+}
+
+// Open exits 2 and 3, on the right and at the bottom of hovering_plane()'s
+// board, and start new planes there and at exit 1:  'b' and 'C' head for
+// each other's exit, and 'd' for exit 0.
+static void crowd(struct plane pls[3]) {
+    exits[n_exits++] = (struct exitspec) { .num = 2, .row = 6, .col = 15 };
+    exits[n_exits++] = (struct exitspec) { .num = 3, .row = 11, .col = 8 };
+    for (int i = 2; i < 4; i++) {
+        cells_add_exit(&exits[i]);
+        costmap_add_exit(&exits[i]);
+    }
+    pls[0] = new_plane('b', true, 2);
+    pls[1] = new_plane('C', false, 1);
+    pls[2] = new_plane('d', true, 0);
+    start_course(&pls[0], 6, 0, 7);
+    start_course(&pls[1], 6, 15, 7);
+    start_course(&pls[2], 11, 8, 7);
+}
+
+// Verify planes appearing together and planned on worker threads come out
+// clear of each other, the ones which ran into another's route replanned.
+static void test_parallel() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 3);
+    workers_init(3);
+    const int planned = n_parallel_planned;
+    const int replanned = n_parallel_replanned;
+
+    struct plane pls[3];
+    crowd(pls);
+    struct plane *planes[3] = { &pls[0], &pls[1], &pls[2] };
+    plan_new_courses(planes, 3);
+    for (int i = 0; i < 3; i++)
+        assert(course_end(&pls[i])->at_exit);
+    assert(n_parallel_planned == planned + 3);
+    assert(n_parallel_replanned > replanned);
+    for (int i = 0; i < 3; i++)
+        check_clear(&pls[i]);
+    done_hovering(&a, n);
+}
+
+// Verify the portfolio planner routes a plane by racing its strategies on
+// the workers, where the greedy search alone can't, and routes a tick's new
+// planes planned together on them, running each one's race in turn,
+// handing back the losers' courses.
+static void test_portfolio() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 3);
+    int races = n_portfolio_races;
+
+    // Behind a wall of traffic across its way to exit 0, 'b' runs the
+    // greedy search out of steps, but A* gets it round.
+    wall(4, 1, 7, 250, false);
+    struct plane b = new_plane('b', true, 0);
+    assert(!plot_course(&b, 6, 0, 7));
+    check_clear(&b);
+    planner = PLANNER_PORTFOLIO;
+    assert(plot_course(&b, 6, 0, 7));
+    assert(course_end(&b)->at_exit);
+    assert(n_portfolio_races == races + 1);
+    check_clear(&b);
+    wall(4, 1, 7, 250, true);
+
+    struct plane pls[3];
+    crowd(pls);
+    struct plane *planes[3] = { &pls[0], &pls[1], &pls[2] };
+    plan_new_courses(planes, 3);
+    for (int i = 0; i < 3; i++)
+        assert(course_end(&pls[i])->at_exit);
+    assert(n_portfolio_races >= races + 4);
+    for (int i = 0; i < 3; i++)
+        check_clear(&pls[i]);
+    assert(search_arena.in_use == 0);
+    planner = PLANNER_GREEDY;
+    done_hovering(&a, n);
+}
+
+// Verify the shadow planner replays a new plane by both planners without
+// touching its course, the reservations or the game's totals, telling
+// where they differ, and drops one whose tick has passed.
+static void test_shadow() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 3);
+    shadow_mode = true;
+    shadow_planner = PLANNER_ASTAR;
+    shadow_file_name = "/dev/null";
+    int shadowed = n_shadowed, stale = n_shadow_stale;
+    int disagreements = n_shadow_disagreements;
+    long r0, s0, r1, s1;
+    get_plan_totals(&r0, &s0);
+
+    // Behind a wall of traffic, the greedy search runs out of steps where
+    // A* gets round, so the two disagree.
+    wall(4, 1, 7, 250, false);
+    unsigned int version = resv_version;
+    struct plane b = new_plane('b', true, 0);
+    start_course(&b, 6, 0, 7);
+    shadow_note(&b);
+    assert(shadow_step());
+    assert(!shadow_step());
+    assert(n_shadowed == shadowed + 1 && b.len == 1);
+    assert(n_shadow_disagreements == disagreements + 1);
+    assert(resv_version == version);
+    get_plan_totals(&r1, &s1);
+    assert(r1 == r0 && s1 == s0);
+    wall(4, 1, 7, 250, true);
+
+    // Once its course is committed, the replays mustn't go around it:  The
+    // same planner as production agrees with it, and with the route flown.
+    assert(extend_course(&b, frame_no));
+    a.next = &b;
+    b.prev = &a;
+    plend = &b;
+    shadow_planner = PLANNER_GREEDY;
+    version = resv_version;
+    disagreements = n_shadow_disagreements;
+    int drifted = n_shadow_drifted;
+    shadow_note(&b);
+    assert(shadow_step());
+    assert(n_shadow_disagreements == disagreements);
+    assert(n_shadow_drifted == drifted);
+    assert(resv_version == version);
+
+    shadow_note(&b);
+    frame_no++;
+    assert(!shadow_step());
+    assert(n_shadow_stale == stale + 1 && n_shadowed == shadowed + 2);
+
+    check_clear(&b);
+    assert(search_arena.in_use == 0);
+    shadow_mode = false;
+    done_hovering(&a, n);
+}
+
+// Verify a route precomputed while idle gets adopted by a plane appearing
+// next tick, and not once the reservations have changed under it, until
+// it's planned again.
+static void test_precompute() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 3);
+    idle_planning = true;
+    frame_no = 4;
+    long r0, s0, r1, s1;
+    get_plan_totals(&r0, &s0);
+    while (precompute_step())
+        ;
+    get_plan_totals(&r1, &s1);
+    assert(r1 == r0 && s1 == s0 && precomputed_courses() > 0);
+
+    frame_no = 5;
+    struct plane b = new_plane('b', true, 0);
+    struct plane d = new_plane('d', false, 0);
+    start_course(&b, 6, 0, 7);
+    start_course(&d, 6, 0, 7);
+    int missed = n_missed;
+    assert(adopt_route(&b));
+    assert(course_end(&b)->at_exit && b.end_tm == last_tick(&b));
+    get_plan_totals(&r1, &s1);
+    assert(r1 == r0 + 1 && s1 > s0);
+    const unsigned int version = resv_version;
+    resv_add_course(&b, 6);
+    assert(resv_version != version);
+    assert(!adopt_route(&d));
+    assert(n_missed == missed + 1);
+
+    // Planned again around 'b', the prop's route is good.
+    check_clear(&d);
+    frame_no = 8;
+    while (precompute_step())
+        ;
+    frame_no = 9;
+    start_course(&d, 6, 0, 7);
+    assert(adopt_route(&d));
+    assert(course_end(&d)->at_exit && n_missed == missed + 1);
+    resv_add_course(&d, 10);
+
+    check_clear(&b);
+    check_clear(&d);
+    precompute_clear();
+    idle_planning = false;
+    done_hovering(&a, n);
+}
+
+// Verify a plan that's out of time leaves a pending start of a route for
+// each planner, with its move onward reserved, and that it's finished
+// later.
+static void test_anytime() {
+    int n = n_courses;
+    const struct timespec past = { .tv_sec = 0, .tv_nsec = 1 };
+    for (int astar = 0; astar < 2; astar++) {
+        struct plane a;
+        hovering_plane(&a, 3);
+        planner = astar ? PLANNER_ASTAR : PLANNER_GREEDY;
+        struct plane b = new_plane('b', true, 0);
+        b.prev = &a;
+        start_course(&b, 6, 0, 7);
+        assert(find_course_until(&b, frame_no, &past) == PLAN_PARTIAL);
+        assert(b.end_tm >= frame_no + MIN_PREFIX && last_tick(&b) ==
+               b.end_tm+1 && !course_end(&b)->at_exit);
+        resv_add_course(&b, frame_no+1);
+        b.pending = true;
+        const struct xyz next = course_end(&b)->pos;
+        const struct xy rc = { .row = next.row, .col = next.col };
+        assert(resv_adjacent(rc, next.alt, true, b.end_tm+1).alt > 0);
+        a.next = &b;  plend = &b;
+
+        frame_no++;
+        resume_courses();
+        assert(!b.pending && course_end(&b)->at_exit);
+        check_clear(&b);
+        done_hovering(&a, n);
+    }
+    planner = PLANNER_GREEDY;
+}
+
+// Verify for each planner a course resumed from near the reservation
+// table's horizon isn't planned past it:  It's left partial there, if the
+// caller takes that and the prefix is long enough, and otherwise unrouted.
+static void test_horizon() {
+    int n = n_courses;
+    struct timespec later;
+    clock_gettime(CLOCK_MONOTONIC, &later);
+    later.tv_sec += 3600;
+    for (int astar = 0; astar < 2; astar++) {
+        struct plane a;
+        hovering_plane(&a, 3);
+        planner = astar ? PLANNER_ASTAR : PLANNER_GREEDY;
+        for (int left = 4; left >= 2; left -= 2) {
+            for (int partial = 0; partial < 2; partial++) {
+                struct plane b = new_plane('b', true, 0);
+                b.start_tm = b.current_tm = frame_no;
+                b.end_tm = frame_no + MAX_TICKS - left;
+                for (int t = b.start_tm; t <= b.end_tm; t++)
+                    add_course_elem(&b, 6, 8, 5, bearing_of("N"), false, 0);
+                const int root_tm = b.end_tm;
+                enum plan_result rv = find_course_until(&b, root_tm,
+                                                        partial ? &later
+                                                                : NULL);
+                if (partial && left == 4) {
+                    assert(rv == PLAN_PARTIAL &&
+                           b.end_tm - root_tm >= MIN_PREFIX);
+                } else {
+                    assert(rv == PLAN_NONE && last_tick(&b) == root_tm);
+                }
+                assert(last_tick(&b) - frame_no < MAX_TICKS);
+                free_course(&b);
+            }
+        }
+        done_hovering(&a, n);
+    }
+    planner = PLANNER_GREEDY;
+}
+
+// Verify a search stopped at the end of every slice and carried on comes
+// out with the same route as one done all at once, and reserved.
+static void test_slices() {
+    int n = n_courses;
+    struct plane a;
+    hovering_plane(&a, 21);
+    struct plane b = new_plane('b', true, 0);
+    start_course(&b, 6, 0, 7);
+    assert(find_course(&b, frame_no));
+    const int len = b.len;
+    struct course whole[len];
+    for (int i = 0; i < len; i++)
+        whole[i] = b.course[i];
+    truncate_course(&b, b.start_tm);
+
+    const struct timespec past = { .tv_sec = 0, .tv_nsec = 1 };
+    struct plane *planes[1] = { &b };
+    begin_planning(planes, 1);
+    int n_slices = 1;
+    while (!plan_slice(&past))
+        n_slices++;
+    assert(n_slices > 1 && b.len == len && !b.pending);
+    for (int i = 0; i < len; i++) {
+        assert(b.course[i].pos.row == whole[i].pos.row &&
+               b.course[i].pos.col == whole[i].pos.col &&
+               b.course[i].pos.alt == whole[i].pos.alt &&
+               b.course[i].bearing == whole[i].bearing &&
+               b.course[i].at_exit == whole[i].at_exit);
+    }
+    check_clear(&b);
+    done_hovering(&a, n);
+}
+
+// Verify that for each planner a plane won't reach its exit on a tick
+// another plane has booked, and that a booking goes with its course.
+static void test_slots() {
+    int n = n_courses;
+    for (int astar = 0; astar < 2; astar++) {
+        struct plane a;
+        hovering_plane(&a, 3);
+        planner = astar ? PLANNER_ASTAR : PLANNER_GREEDY;
+        struct plane b = new_plane('b', true, 0);
+        assert(!slot_free(&b, 3) && slot_free(&a, 3) && slot_free(&b, 4));
+        assert(plot_course(&b, 6, 0, 7));
+        const int arrival = last_tick(&b);
+        check_clear(&b);
+
+        // Book the tick 'b' got there for a plane 'c' leaving just then.
+        struct plane c = new_plane('c', true, 0);
+        add_course_elem(&c, 0, 8, 9, bearing_of("N"), true, 0);
+        course_end(&c)->at_exit = true;
+        c.start_tm = c.current_tm = c.end_tm = arrival;
+        resv_add_course(&c, arrival);
+        assert(!slot_free(&b, arrival));
+
+        assert(plot_course(&b, 6, 0, 7));
+        assert(course_end(&b)->at_exit && last_tick(&b) > arrival);
+        assert(b.slot_lo > arrival && b.slot_lo <= last_tick(&b));
+        check_clear(&b);
+        check_clear(&c);
+        assert(slot_free(&b, arrival));
+        done_hovering(&a, n);
+        assert(slot_free(&b, 3));
+    }
+    planner = PLANNER_GREEDY;
 }
 
 static void test_calc_next_move() {
     board_width = 20;
     board_height = 20;
+    cells_init();
+    resv_init();
 
     test_blocked();
     test_matchcourse();
 }
 
-static inline bool xyz_eq(struct xyz a, struct xyz b) {
-    return a.row == b.row && a.col == b.col && a.alt == b.alt;
+// A board for comparing and timing the move kernels:  An exit on the top
+// and one on the left, an airport in the middle facing north, and 'n'
+// planes scattered about at ticks 'tick' and 'tick'+1.
+static void kernel_board(int n, int tick) {
+    board_width = 30;  board_height = 21;
+    resv_init();
+    n_exits = 2;
+    exits[0] = (struct exitspec) { .num = 0, .row = 0, .col = 12 };
+    exits[1] = (struct exitspec) { .num = 1, .row = 9, .col = 0 };
+    n_airports = 1;
+    const int N = bearing_of("N");
+    airports[0] = (struct airport) { .num = 0, .row = 10, .col = 15,
+                                     .bearing = N, .trow = 11, .tcol = 15,
+                                     .strow1 = 11, .stcol1 = 16,
+                                     .strow2 = 11, .stcol2 = 14 };
+    for (int i = -2; i <= 2; i++)
+        airports[0].exc[i+2] = apply(10, 15, (N+i) & 7);
+    airports[0].exc[5] = (struct xy) { 10, 15 };
+    cells_init();
+    costmap_init();
+    for (int i = 0; i < n_exits; i++) {
+        cells_add_exit(&exits[i]);
+        costmap_add_exit(&exits[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct course c = { .pos = { .row = 1 + rand() % 19,
+                                     .col = 1 + rand() % 28,
+                                     .alt = 1 + rand() % 9 },
+                            .bearing = rand() % 8 };
+        resv_stamp('A' + i, rand() % 2, &c, tick + rand() % 2);
+    }
+}
+
+// A plane's state to move from, mostly in the open, sometimes in exit 1.
+struct move_state {
+    int row, col, alt, bearing;
+    bool cleared_exit;
+};
+
+static struct move_state random_state() {
+    if (rand() % 8 == 0) {
+        return (struct move_state) { .row = 9, .col = 0, .alt = 7,
+                                     .bearing = bearing_of("E") };
+    }
+    return (struct move_state) { .row = 1 + rand() % 19,
+                                 .col = 1 + rand() % 28,
+                                 .alt = 1 + rand() % 9,
+                                 .bearing = rand() % 8,
+                                 .cleared_exit = rand() % 2 };
+}
+
+// Verify the specialized move kernels choose just as calc_next_move()
+// does, for each type of plane and kind of target.
+static void test_move_kernels() {
+    for (int b = 0; b < 8; b++) {
+        struct xy rc = apply(5, 5, b);
+        assert(rc.row == 5 + bearings[b].drow &&
+               rc.col == 5 + bearings[b].dcol);
+    }
+    srand(54321);
+    kernel_board(40, 10);
+    struct traffic_view view = { .tick0 = 10 };
+    for (int kind = 0; kind < 4; kind++) {
+        struct plane pl = { .id = 'k', .isjet = kind & 1,
+                            .target_airport = kind >> 1,
+                            .target_num = kind >> 1 ? 0 : 1 };
+        move_kernel *move = move_kernel_for(&pl);
+        assert(move != calc_next_move);
+        const struct xyz target = plane_target(&pl);
+        for (int i = 0; i < 500; i++) {
+            const struct move_state ms = random_state();
+            int alt = ms.alt, bearing = ms.bearing;
+            int kalt = ms.alt, kbearing = ms.bearing;
+            struct frame fr = { .depth = 0 }, kfr = { .depth = 0 };
+            calc_next_move(&pl, ms.row, ms.col, &alt, target, &bearing,
+                           ms.cleared_exit, &view, &fr);
+            move(&pl, ms.row, ms.col, &kalt, target, &kbearing,
+                 ms.cleared_exit, &view, &kfr);
+            assert(alt == kalt && fr.n_cand == kfr.n_cand);
+            if (alt >= 0)
+                assert(bearing == kbearing);
+            for (int j = 0; j < fr.n_cand; j++) {
+                assert(fr.cand[j].bearing == kfr.cand[j].bearing &&
+                       fr.cand[j].alt == kfr.cand[j].alt &&
+                       fr.cand[j].distance == kfr.cand[j].distance);
+            }
+        }
+    }
+    resv_clear();
+    costmap_clear();
+    n_exits = n_airports = 0;
+}
+
+// Verify an airport's landing funnel leads in to its target, and that a
+// plane getting into it is flown in by it, with and without a plane
+// about in the way.
+static void test_funnel() {
+    int n = n_courses;
+    kernel_board(0, 0);
+    frame_no = 1;
+    const int N = bearing_of("N");
+    struct plane f = { .id = 'f', .isjet = true, .target_airport = true,
+                       .target_num = 0, .prev = NULL, .next = NULL };
+    // From 3 moves south of the target, straight on or a 45 degree turn
+    // at any altitude change keeps it 3 moves out, but a 90 degree one
+    // doesn't.
+    assert(funnel_moves(&f, 14, 15, 2, N, true) == 0xff8);
+    assert(funnel_moves(&f, 2, 15, 5, N, true) == 0);
+    assert(funnel_moves(&f, 11, 15, 1, N, true) == 0);
+
+    const struct course blocker = { .pos = { .row = 13, .col = 14,
+                                             .alt = 1 },
+                                    .bearing = N };
+    // Flown down the funnel, with a lane blocked and without; searched in
+    // without "-F"; and flown down it for a tally, which isn't counted.
+    for (int run = 0; run < 4; run++) {
+        const bool blocked = run == 1;
+        struct plan_tally tally = { 0, 0, 0, 0, 0 };
+        fly_funnels = run != 2;
+        if (run == 3)
+            plan_tally = &tally;
+        if (blocked)
+            reserve('x', true, &blocker, 1, 8);
+        int landings = n_funnel_landings;
+        f.course = NULL;
+        f.len = f.cap = 0;
+        add_course_elem(&f, 17, 15, 3, N, true, 0);
+        f.start_tm = f.current_tm = frame_no;
+        f.pending = false;
+        resv_stamp(f.id, f.isjet, f.course, frame_no);
+        assert(extend_course(&f, frame_no));
+        assert(course_end(&f)->pos.alt == -2);
+        assert(n_funnel_landings == landings + (run < 2));
+        assert(tally.funnel_landings == (run == 3));
+        check_clear(&f);
+        if (blocked)
+            unreserve('x', &blocker, 1, 8);
+        plan_tally = NULL;
+    }
+    fly_funnels = false;
+    resv_clear();
+    costmap_clear();
+    n_exits = n_airports = 0;
+    assert(n_courses == n);
+}
+
+// Verify the landing tree tells which funnel states can be flown in from
+// with a plane parked by the target, and that the bidirectional planner
+// gets a plane in around it.
+static void test_landing_tree() {
+    int n = n_courses;
+    kernel_board(0, 0);
+    frame_no = 1;
+    const int N = bearing_of("N");
+    struct plane f = { .id = 'f', .isjet = true, .target_airport = true,
+                       .target_num = 0, .prev = NULL, .next = NULL };
+    const struct course blocker = { .pos = { .row = 12, .col = 14,
+                                             .alt = 2 },
+                                    .bearing = N };
+    reserve('x', true, &blocker, 1, 12);
+
+    struct landing_tree lt;
+    landing_begin(&lt, &f, 1);
+    assert(!landing_reaches(&lt, 14, 15, 2, N, true, 2));
+    assert(landing_reaches(&lt, 14, 15, 2, N, true, 11));
+    assert(landing_reaches(&lt, 2, 15, 5, N, true, 2));
+    arena_reset(&search_arena);
+
+    planner = PLANNER_BIDIR;
+    plstart = plend = &f;
+    int prunes = n_landing_prunes;
+    f.course = NULL;
+    f.len = f.cap = 0;
+    add_course_elem(&f, 17, 15, 3, N, true, 0);
+    f.start_tm = f.current_tm = frame_no;
+    f.pending = false;
+    resv_stamp(f.id, f.isjet, f.course, frame_no);
+    assert(extend_course(&f, frame_no));
+    assert(course_end(&f)->pos.alt == -2 && f.end_tm > 13);
+    assert(n_landing_prunes > prunes);
+    check_clear(&f);
+    planner = PLANNER_GREEDY;
+    plstart = plend = NULL;
+
+    unreserve('x', &blocker, 1, 12);
+    resv_clear();
+    costmap_clear();
+    n_exits = n_airports = 0;
+    assert(n_courses == n);
+}
+
+// A 60 by 20 board, with exits at the middle of its left and right edges.
+static void wide_board() {
+    board_width = 60;  board_height = 20;
+    resv_init();
+    n_exits = 2;
+    exits[0] = (struct exitspec) { .num = 0, .row = 10, .col = 0 };
+    exits[1] = (struct exitspec) { .num = 1, .row = 10, .col = 59 };
+    n_airports = 0;
+    cells_init();
+    costmap_init();
+    for (int i = 0; i < n_exits; i++) {
+        cells_add_exit(&exits[i]);
+        costmap_add_exit(&exits[i]);
+    }
+}
+
+// Verify that a coarse route goes around the blocks loaded with traffic
+// across the middle of the wide board, and that the hierarchical planner
+// gets a plane across keeping to it.
+static void test_coarse_route() {
+    int n = n_courses;
+    wide_board();
+    frame_no = 1;
+    const int E = bearing_of("E");
+    struct course parked[3];
+    for (int i = 0; i < 3; i++) {
+        parked[i] = (struct course) { .pos = { .row = 6 + 4*i, .col = 29,
+                                               .alt = 5 },
+                                      .bearing = E };
+        reserve('A' + i, true, &parked[i], 1, 40);
+    }
+    struct plane f = { .id = 'f', .isjet = true, .target_airport = false,
+                       .target_num = 1, .prev = NULL, .next = NULL };
+    f.course = NULL;
+    f.len = f.cap = 0;
+    add_course_elem(&f, 10, 1, 7, E, false, 0);
+    f.start_tm = f.current_tm = frame_no;
+    f.pending = false;
+
+    struct block_route br;
+    assert(coarse_route(&f, frame_no, &br));
+    assert(br.n_hops == 14);
+    // Around the loaded blocks one way or the other, past the row of
+    // them, and straight on elsewhere.
+    assert(br.in[0][7] != br.in[4][7]);
+    assert(br.in[2][0] && br.in[2][14] && !br.in[0][1] && !br.in[4][1]);
+
+    planner = PLANNER_HIER;
+    plstart = plend = &f;
+    int retries = n_route_retries;
+    resv_stamp(f.id, f.isjet, f.course, frame_no);
+    assert(extend_course(&f, frame_no));
+    assert(course_end(&f)->at_exit && n_route_retries == retries);
+    for (int t = f.start_tm; t <= last_tick(&f); t++) {
+        const struct course *c = course_at(&f, t);
+        assert(in_block_route(&br, c->pos.row, c->pos.col));
+    }
+    check_clear(&f);
+    planner = PLANNER_GREEDY;
+    plstart = plend = NULL;
+
+    for (int i = 0; i < 3; i++)
+        unreserve('A' + i, &parked[i], 1, 40);
+    resv_clear();
+    costmap_clear();
+    n_exits = 0;
+    assert(n_courses == n);
+}
+
+static double ns_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1e9 +
+           (now.tv_nsec - start->tv_nsec);
+}
+
+// Reserve (or with 'un', unreserve) a ring of planes about the square
+// from (lo, lo) to (hi, hi), at every altitude, for ticks 1 through 't1'.
+static void cage(int lo, int hi, int t1, bool un) {
+    for (int i = lo; i <= hi; i++) {
+        const int ring[4][2] = { { lo, i }, { hi, i }, { i, lo }, { i, hi } };
+        for (int side = 0; side < 4; side++) {
+            for (int alt = 2; alt <= 8; alt += 3) {
+                const struct course c = {
+                    .pos = { ring[side][0], ring[side][1], alt },
+                    .bearing = 0 };
+                if (un)
+                    unreserve('A' + side, &c, 1, t1);
+                else
+                    reserve('A' + side, true, &c, 1, t1);
+            }
+        }
+    }
+}
+
+struct cage_stats {
+    long searches, routes, steps, pruned;
+    double ns;
+};
+
+// Plan planes out of cages of traffic, with blips of traffic in them,
+// which they have to circle in until the cage opens, backtracking out of
+// the blips.  Each is planned without dominance pruning and with it, into
+// 'st[0]' and 'st[1]', checking that pruning doesn't change the routes
+// found, or whether one is found, unless without it the search runs out
+// of steps.
+static void caged_trials(int trials, struct cage_stats st[2]) {
+    enum { N_BLIPS = 12 };
+    kernel_board(0, 0);
+    frame_no = 1;
+    for (int trial = 0; trial < trials; trial++) {
+        const int t1 = 10 + rand() % 30;
+        cage(8, 14, t1, false);
+        struct course blips[N_BLIPS];
+        int blip_tm[N_BLIPS];
+        for (int i = 0; i < N_BLIPS; i++) {
+            blips[i] = (struct course) {
+                .pos = { 10 + rand() % 3, 10 + rand() % 3, 1 + rand() % 9 },
+                .bearing = 0 };
+            blip_tm[i] = 2 + rand() % (t1 - 1);
+            reserve('a' + i, true, &blips[i], blip_tm[i], blip_tm[i]);
+        }
+        struct plane f[2];
+        bool found[2];
+        const int row = 10 + rand() % 3, col = 10 + rand() % 3;
+        const int alt = 3 + rand() % 5, bearing = rand() % 8;
+        const bool isjet = rand() % 2;
+        for (int prune = 0; prune < 2; prune++) {
+            prune_dominated = prune;
+            f[prune] = (struct plane) { .id = 'f', .isjet = isjet,
+                                        .target_airport = false,
+                                        .target_num = 0,
+                                        .course = NULL, .len = 0, .cap = 0,
+                                        .prev = NULL, .next = NULL };
+            add_course_elem(&f[prune], row, col, alt, bearing, true, 0);
+            f[prune].start_tm = f[prune].current_tm = frame_no;
+            long r0, s0, r1, s1;
+            int p0 = n_dominance_prunes;
+            struct timespec start;
+            get_plan_totals(&r0, &s0);
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            found[prune] = find_course(&f[prune], frame_no);
+            st[prune].ns += ns_since(&start);
+            get_plan_totals(&r1, &s1);
+            st[prune].searches++;
+            st[prune].routes += r1 - r0;
+            st[prune].steps += s1 - s0;
+            st[prune].pruned += n_dominance_prunes - p0;
+        }
+        assert(found[1] || !found[0]);
+        if (found[0])
+            assert(f[0].len == f[1].len);
+        for (int i = 0; found[0] && i < f[0].len; i++) {
+            assert(xyz_eq(f[0].course[i].pos, f[1].course[i].pos) &&
+                   f[0].course[i].bearing == f[1].course[i].bearing);
+        }
+        free_course(&f[0]);
+        free_course(&f[1]);
+        cage(8, 14, t1, true);
+        for (int i = 0; i < N_BLIPS; i++)
+            unreserve('a' + i, &blips[i], blip_tm[i], blip_tm[i]);
+    }
+    prune_dominated = true;
+    resv_clear();
+    costmap_clear();
+    n_exits = n_airports = 0;
+}
+
+// Verify each entry of a route has the exit cleared if the one before had
+// it or cleared it, including those the search went on to after
+// backtracking, over crossings made through random blips of traffic.
+static void test_backtrack_flags() {
+    enum { N_BLIPS = 40 };
+    int n = n_courses;
+    srand(9);
+    for (int trial = 0; trial < 50; trial++) {
+        struct plane a;
+        hovering_plane(&a, 3);
+        struct course blips[N_BLIPS];
+        int blip_tm[N_BLIPS];
+        for (int i = 0; i < N_BLIPS; i++) {
+            blips[i] = (struct course) {
+                .pos = { 1 + rand() % 10, 1 + rand() % 14, 1 + rand() % 9 },
+                .bearing = 0 };
+            blip_tm[i] = 2 + rand() % 12;
+            reserve('A' + i, true, &blips[i], blip_tm[i], blip_tm[i]);
+        }
+        struct plane b = new_plane('b', rand() % 2, 0);
+        plot_course(&b, 6, 0, 7);
+        for (int i = 1; i < b.len; i++) {
+            const struct course *prev = &b.course[i-1];
+            assert(b.course[i].cleared_exit ==
+                   (prev->cleared_exit || clears_exit(prev->pos.row,
+                                                      prev->pos.col,
+                                                      prev->pos.alt)));
+        }
+        check_clear(&b);
+        for (int i = 0; i < N_BLIPS; i++)
+            unreserve('A' + i, &blips[i], blip_tm[i], blip_tm[i]);
+        done_hovering(&a, n);
+    }
+}
+
+// Verify that dominance pruning skips states the search has been through
+// before without changing the routes it finds.
+static void test_dominance() {
+    int n = n_courses;
+    struct cage_stats st[2] = { { 0 }, { 0 } };
+    srand(777);
+    caged_trials(40, st);
+    assert(st[0].pruned == 0 && st[1].pruned > 0);
+    assert(st[1].routes >= st[0].routes);
+    assert(n_courses == n);
+}
+
+// Time a move by calc_next_move() against one by the move kernels, for
+// each type of plane and kind of target, over the same random states.
+// Where a planner benchmark parks its traffic and starts its planes, each
+// a box of (row, col, alt) from 'lo' taking 'n' values of each, and where
+// its planes are bound.
+struct bench_spec {
+    const char *what;
+    int n_parked;
+    struct xyz park_lo, park_n, start_lo, start_n;
+    int bearing;
+    bool target_airport;
+    int target_num;
+};
+
+// Plan a plane from random starts with traffic parked at random on the
+// board set up, by the greedy search without dominance pruning and with
+// it, and by 'other', and compare the search steps per route, the
+// expansions pruned, and the mean and longest search times.
+static void bench_planners(const struct bench_spec *bs,
+                           enum planner_kind other, const char *name) {
+    enum { TRIALS = 500, MAX_PARKED = 26, RUNS = 3 };
+    const char *const names[RUNS] = { "greedy, no dom.", "greedy", name };
+    const enum planner_kind planners[RUNS] = { PLANNER_GREEDY,
+                                               PLANNER_GREEDY, other };
+    long routes[RUNS] = { 0 }, steps[RUNS] = { 0 }, pruned[RUNS] = { 0 };
+    double ns[RUNS] = { 0 }, max_ns[RUNS] = { 0 };
+    int searches = 0;
+    const enum planner_kind old_planner = planner;
+    const int old_frame = frame_no;
+    assert(bs->n_parked <= MAX_PARKED);
+
+    frame_no = 1;
+    for (int trial = 0; trial < TRIALS; trial++) {
+        struct course parked[MAX_PARKED];
+        int from[MAX_PARKED], to[MAX_PARKED];
+        for (int i = 0; i < bs->n_parked; i++) {
+            parked[i] = (struct course) {
+                .pos = { .row = bs->park_lo.row + rand() % bs->park_n.row,
+                         .col = bs->park_lo.col + rand() % bs->park_n.col,
+                         .alt = bs->park_lo.alt + rand() % bs->park_n.alt },
+                .bearing = rand() % 8 };
+            from[i] = 1 + rand() % 10;
+            to[i] = from[i] + rand() % 20;
+            reserve('A' + i, rand() % 2, &parked[i], from[i], to[i]);
+        }
+        struct plane f = { .id = 'f', .isjet = rand() % 2,
+                           .target_airport = bs->target_airport,
+                           .target_num = bs->target_num,
+                           .prev = NULL, .next = NULL };
+        struct xy start = { .row = bs->start_lo.row + rand() % bs->start_n.row,
+                            .col = bs->start_lo.col +
+                                   rand() % bs->start_n.col };
+        const int alt = bs->start_lo.alt + rand() % bs->start_n.alt;
+        if (resv_adjacent(start, alt, f.isjet, 1).alt <= 0) {
+            for (int which = 0; which < RUNS; which++) {
+                planner = planners[which];
+                prune_dominated = which > 0;
+                f.course = NULL;
+                f.len = f.cap = 0;
+                add_course_elem(&f, start.row, start.col, alt, bs->bearing,
+                                true, 0);
+                f.start_tm = f.current_tm = frame_no;
+                long r0, s0, r1, s1;
+                int p0 = n_dominance_prunes;
+                struct timespec start;
+                get_plan_totals(&r0, &s0);
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                bool found = find_course(&f, frame_no);
+                double took = ns_since(&start);
+                ns[which] += took;
+                if (took > max_ns[which])
+                    max_ns[which] = took;
+                get_plan_totals(&r1, &s1);
+                if (found) {
+                    routes[which] += r1 - r0;
+                    steps[which] += s1 - s0;
+                    pruned[which] += n_dominance_prunes - p0;
+                }
+                free_course(&f);
+            }
+            searches++;
+        }
+        for (int i = 0; i < bs->n_parked; i++)
+            unreserve('A' + i, &parked[i], from[i], to[i]);
+    }
+    resv_clear();
+    costmap_clear();
+    n_exits = n_airports = 0;
+    planner = old_planner;
+    prune_dominated = true;
+    frame_no = old_frame;
+
+    printf("%-16s %10s %10s %10s %10s %10s\n", bs->what, "routes",
+           "steps/route", "pruned", "us/search", "max us");
+    for (int which = 0; which < RUNS; which++) {
+        double per = routes[which] ? (double) steps[which] / routes[which]
+                                   : 0;
+        double us = searches ? ns[which] / searches / 1000 : 0;
+        printf("%-16s %10ld %10.1f %10ld %10.1f %10.1f\n", names[which],
+               routes[which], per, pruned[which], us, max_ns[which] / 1000);
+        fprintf(logff, "Planner benchmark, %s, %s:  %ld routes, %.1f steps "
+                       "per route, %ld expansions pruned as dominated, "
+                       "%.1f us per search, %.1f us at most.\n", bs->what,
+                names[which], routes[which], per, pruned[which], us,
+                max_ns[which] / 1000);
+    }
+}
+
+// Short routes on the empty kernel board, by the greedy search and by A*,
+// where what a search costs to set up counts most.
+static void bench_short_routes() {
+    enum { REPS = 500 };
+    static const char *const names[2] = { "greedy", "astar" };
+    const enum planner_kind kinds[2] = { PLANNER_GREEDY, PLANNER_ASTAR };
+    kernel_board(0, 0);
+    frame_no = 1;
+    printf("%-16s %10s\n", "short routes", "us/search");
+    for (int k = 0; k < 2; k++) {
+        double ns = 0;
+        for (int rep = 0; rep < REPS; rep++) {
+            struct plane f = { .id = 'f', .isjet = true,
+                               .target_airport = false, .target_num = 0,
+                               .course = NULL, .len = 0, .cap = 0,
+                               .prev = NULL, .next = NULL };
+            add_course_elem(&f, 4, 12, 7, bearing_of("N"), true, 0);
+            f.start_tm = f.current_tm = frame_no;
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            enum plan_result rv = plan_course(&f, frame_no, NULL, kinds[k]);
+            ns += ns_since(&start);
+            assert(rv == PLAN_FOUND);
+            free_course(&f);
+        }
+        printf("%-16s %10.1f\n", names[k], ns / REPS / 1000);
+        fprintf(logff, "Planner benchmark, short routes, %s:  %.1f us per "
+                       "search.\n", names[k], ns / REPS / 1000);
+    }
+    resv_clear();
+    costmap_clear();
+    n_exits = n_airports = 0;
+}
+
+// Landings on the kernel board, with traffic parked about the approach.
+static void bench_landings() {
+    static const struct bench_spec bs = {
+        .what = "landing plans", .n_parked = 26,
+        .park_lo = { 11, 11, 1 }, .park_n = { 8, 9, 3 },
+        .start_lo = { 2, 3, 4 }, .start_n = { 17, 10, 4 },
+        .bearing = 4, .target_airport = true, .target_num = 0,
+    };
+    srand(2);
+    kernel_board(0, 0);
+    bench_planners(&bs, PLANNER_BIDIR, "bidir");
+}
+
+// Crossings of the wide board, from near its left exit to its right one,
+// with traffic parked across the middle.
+static void bench_crossings() {
+    static const struct bench_spec bs = {
+        .what = "crossings", .n_parked = 26,
+        .park_lo = { 2, 15, 7 }, .park_n = { 16, 30, 3 },
+        .start_lo = { 8, 1, 7 }, .start_n = { 5, 3, 1 },
+        .bearing = 2, .target_airport = false, .target_num = 1,
+    };
+    srand(3);
+    wide_board();
+    bench_planners(&bs, PLANNER_HIER, "hier");
+}
+
+// The crossings again, and the landings, racing the portfolio on the
+// workers.
+static void bench_races() {
+    static const struct bench_spec bs = {
+        .what = "crossings", .n_parked = 26,
+        .park_lo = { 2, 15, 7 }, .park_n = { 16, 30, 3 },
+        .start_lo = { 8, 1, 7 }, .start_n = { 5, 3, 1 },
+        .bearing = 2, .target_airport = false, .target_num = 1,
+    };
+    static const struct bench_spec lbs = {
+        .what = "landing plans", .n_parked = 26,
+        .park_lo = { 11, 11, 1 }, .park_n = { 8, 9, 3 },
+        .start_lo = { 2, 3, 4 }, .start_n = { 17, 10, 4 },
+        .bearing = 4, .target_airport = true, .target_num = 0,
+    };
+    workers_init(4);
+    srand(3);
+    wide_board();
+    bench_planners(&bs, PLANNER_PORTFOLIO, "portfolio");
+    srand(2);
+    kernel_board(0, 0);
+    bench_planners(&lbs, PLANNER_PORTFOLIO, "portfolio");
+    log_portfolio(NULL);
+}
+
+// Caged planes, planned with and without dominance pruning.
+static void bench_cages() {
+    static const char *const names[2] = { "greedy, no dom.", "greedy" };
+    struct cage_stats st[2] = { { 0 }, { 0 } };
+    srand(4);
+    caged_trials(500, st);
+    printf("%-16s %10s %10s %10s %10s\n", "caged", "routes",
+           "steps/route", "pruned", "us/search");
+    for (int i = 0; i < 2; i++) {
+        double per = st[i].routes ? (double) st[i].steps / st[i].routes : 0;
+        double us = st[i].ns / st[i].searches / 1000;
+        printf("%-16s %10ld %10.1f %10ld %10.1f\n", names[i], st[i].routes,
+               per, st[i].pruned, us);
+        fprintf(logff, "Planner benchmark, caged, %s:  %ld routes, %.1f "
+                       "steps per route, %ld expansions pruned as "
+                       "dominated, %.1f us per search.\n", names[i],
+                st[i].routes, per, st[i].pruned, us);
+    }
+}
+
+int benchmain() {
+    enum { N_STATES = 4096, REPS = 100 };
+    static const char *const kinds[4] = {
+        "prop to exit", "jet to exit", "prop to airport", "jet to airport"
+    };
+    static struct move_state states[N_STATES];
+
+    srand(1);
+    kernel_board(40, 10);
+    struct traffic_view view = { .tick0 = 10 };
+    for (int i = 0; i < N_STATES; i++)
+        states[i] = random_state();
+
+    printf("%-16s %10s %10s\n", "ns per move", "generic", "kernel");
+    for (int kind = 0; kind < 4; kind++) {
+        struct plane pl = { .id = 'k', .isjet = kind & 1,
+                            .target_airport = kind >> 1,
+                            .target_num = kind >> 1 ? 0 : 1 };
+        const struct xyz target = plane_target(&pl);
+        move_kernel *const paths[2] = { calc_next_move,
+                                        move_kernel_for(&pl) };
+        double ns[2];
+        for (int path = 0; path < 2; path++) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int rep = 0; rep < REPS; rep++) {
+                for (int i = 0; i < N_STATES; i++) {
+                    int alt = states[i].alt, bearing = states[i].bearing;
+                    struct frame fr = { .depth = 0 };
+                    paths[path](&pl, states[i].row, states[i].col, &alt,
+                                target, &bearing, states[i].cleared_exit,
+                                &view, &fr);
+                }
+            }
+            ns[path] = ns_since(&start) / (REPS * N_STATES);
+        }
+        printf("%-16s %10.1f %10.1f\n", kinds[kind], ns[0], ns[1]);
+        fprintf(logff, "Move kernel benchmark, %s:  generic %.1f ns, "
+                       "kernel %.1f ns per move.\n", kinds[kind], ns[0],
+                ns[1]);
+    }
+    resv_clear();
+    costmap_clear();
+    bench_short_routes();
+    bench_landings();
+    bench_crossings();
+    bench_cages();
+    bench_races();
+    return 0;
 }
 
 static void test_excl_landing(int alt, int exp_n_cands) {
     board_width = board_height = 10;
+    resv_init();
     const int srow = 6, scol = 5;
     n_airports = 1;
     struct airport G = { .num = 0, .row = 6, .col = 5, .trow = 5, .tcol = 5,
@@ -150,19 +1472,21 @@ static void test_excl_landing(int alt, int exp_n_cands) {
         G.exc[i].col = scol;
     }
     airports[0] = G;
+    cells_init();
     frame_no = 1;
 
     struct plane pl = { .id = 'e', .isjet = true, .target_airport = true,
-                        .target_num = 0, .start = NULL, .end = NULL,
+                        .target_num = 0, .course = NULL, .len = 0,
                         .start_tm = -1, .end_tm = -1,
                         .prev = NULL, .next = NULL };
     plstart = plend = &pl;
     struct xyz target = { .row = 5, .col = 5, .alt = 1 };
     int bearing = 0;  // north
 
-    struct frame fr = { .opc_start = NULL, .prev = NULL, .next = NULL,
-                        .n_cand = 0 };
-    calc_next_move(&pl, srow, scol, &alt, target, &bearing, false, &fr);
+    struct traffic_view view = { .tick0 = 2 };
+    struct frame fr = { .depth = 0, .n_cand = 0 };
+    calc_next_move(&pl, srow, scol, &alt, target, &bearing, false, &view,
+                   &fr);
     assert(fr.n_cand == exp_n_cands);
 
     for (int i = 0; i < fr.n_cand; i++) {
@@ -172,6 +1496,32 @@ static void test_excl_landing(int alt, int exp_n_cands) {
     }
 }
 
+// Take 'p's course out of the reservation table, checking it stays clear
+// of the other planes all the way, and free it.
+static void check_clear(struct plane *p) {
+    resv_remove_course(p, p->current_tm);
+    for (int tick = p->current_tm; tick < last_tick(p); tick++) {
+        const struct course *c = course_at(p, tick);
+        if (c->pos.alt > 0) {
+            struct xy rc = { .row = c->pos.row, .col = c->pos.col };
+            assert(resv_adjacent(rc, c->pos.alt, true, tick).alt < 0);
+        }
+    }
+    free_course(p);
+}
+
+// Route 'p' with A*, and check it lands no later than the greedy search's
+// route did, staying clear of the other planes all the way.
+static void check_astar(struct plane *p, int row, int col, int greedy_end) {
+    start_course(p, row, col, 0);
+    assert(astar_course(p, frame_no, NULL) == PLAN_FOUND);
+    assert(p->end_tm <= greedy_end);
+    assert(course_end(p)->pos.alt == -2);
+    assert(search_arena.in_use == 0);
+    resv_unstamp(p->id, p->course, p->start_tm);
+    check_clear(p);
+}
+
 static void test_plot_course(bool isprop) {
     // Test a course where have to backtrack.
     /*     0123456789abc
@@ -219,27 +1569,24 @@ static void test_plot_course(bool isprop) {
         { .row = -1, .col = -1, .alt = -2 },
     };
     struct course c1 = { .pos = { .row = 6, .col = 6, .alt = 1 },
-                         .bearing = -1, .prev = &c1, .next = &c1 };
+                         .bearing = -1 };
     struct course c2 = { .pos = { .row = 8, .col = 8, .alt = 1 },
-                         .bearing = -1, .prev = &c2, .next = &c2 };
+                         .bearing = -1 };
     struct course c3 = { .pos = { .row = 8, .col = 4, .alt = 1 },
-                         .bearing = -1, .prev = &c3, .next = &c3 };
+                         .bearing = -1 };
     struct course c4 = { .pos = { .row = 7, .col = 6, .alt = 4 },
-                         .bearing = -1, .prev = &c4, .next = &c4 };
+                         .bearing = -1 };
     struct plane pls[5] = {
-      { .id = 'a', .start = &c1, .current = &c1, .end = &c1,
-        .prev = NULL, .next = &pls[1] },
-      { .id = 'b', .start = &c2, .current = &c2, .end = &c2,
-        .prev = &pls[0], .next = &pls[2] },
-      { .id = 'c', .start = &c3, .current = &c3, .end = &c3,
-        .prev = &pls[1], .next = &pls[4] },
-      { .id = 'd', .start = &c4, .current = &c4, .end = &c4,
-        .prev = &pls[2], .next = &pls[4] },
+      { .id = 'a', .course = &c1, .len = 1, .prev = NULL, .next = &pls[1] },
+      { .id = 'b', .course = &c2, .len = 1, .prev = &pls[0], .next = &pls[2] },
+      { .id = 'c', .course = &c3, .len = 1, .prev = &pls[1], .next = &pls[4] },
+      { .id = 'd', .course = &c4, .len = 1, .prev = &pls[2], .next = &pls[4] },
       { .id = isprop ? 'S' : 's', .isjet = !isprop, .target_airport = true,
-        .target_num = 0, .start = NULL, .current = NULL, .end = NULL,
+        .target_num = 0, .course = NULL, .len = 0,
         .prev = &pls[2], .next = NULL } };
     void add_plane_d() {
         pls[2].next = &pls[3];  pls[4].prev = &pls[3];
+        reserve('d', false, &c4, 1, 100);
     }
     plstart = pls;  plend = &pls[3];
     n_airports = 2;
@@ -252,37 +1599,46 @@ static void test_plot_course(bool isprop) {
     }
     airports[0] = S;
     airports[1] = G;
+    cells_init();
+    resv_init();
+    for (int i = 0; i < 3; i++)
+        reserve(pls[i].id, false, pls[i].course, 1, 100);
 
     int alt = 0;
     frame_no = 1;
     plot_course(&pls[4], srow, scol, alt);
-    check_course(pls[4].start, excr, EXC_LEN, isprop);
-    remove_course_entries(pls[4].start);
-    pls[4].start = pls[4].end = NULL;
-    assert(n_malloc == n_free);
+    check_course(&pls[4], excr, EXC_LEN, isprop);
+    resv_remove_course(&pls[4], pls[4].start_tm);
+    free_course(&pls[4]);
+    check_astar(&pls[4], srow, scol, pls[4].end_tm);
+    assert(n_courses == 0);
+    assert(search_arena.in_use == 0);
 
     // Test a double backtrack.
     add_plane_d();
     alt = 0;
     plot_course(&pls[4], srow, scol, alt);
-    check_course(pls[4].start, excr2, EXC_LEN_B, isprop);
-    remove_course_entries(pls[4].start);
-    assert(n_malloc == n_free);
+    check_course(&pls[4], excr2, EXC_LEN_B, isprop);
+    resv_remove_course(&pls[4], pls[4].start_tm);
+    free_course(&pls[4]);
+    check_astar(&pls[4], srow, scol, pls[4].end_tm);
+    assert(n_courses == 0);
+    assert(search_arena.in_use == 0);
+    resv_clear();
 }
 
-static void check_course(struct course *c, struct xyz *excr, int exlen,
+static void check_course(const struct plane *p, struct xyz *excr, int exlen,
                          bool isprop) {
+    int n = 0;
     for (int i = 0; i < exlen; i++) {
-        assert(c);
-        assert(xyz_eq(c->pos, excr[i]));
-        c = c->next;
+        assert(n < p->len);
+        assert(xyz_eq(p->course[n++].pos, excr[i]));
         if (isprop && i && i != exlen-1) {
-            assert(c);
-            assert(xyz_eq(c->pos, excr[i]));
-            c = c->next;
+            assert(n < p->len);
+            assert(xyz_eq(p->course[n++].pos, excr[i]));
         }
     }
-    assert(!c);
+    assert(n == p->len);
 }
 
 int testmain() {
@@ -291,6 +1647,29 @@ int testmain() {
     test_plot_course(true);
     test_excl_landing(1, 9);
     test_excl_landing(2, 14);
+    test_arena();
+    test_cells();
+    test_trace();
+    test_heuristics();
+    test_resv();
+    test_check_moves();
+    test_costmap();
+    test_move_kernels();
+    test_funnel();
+    test_landing_tree();
+    test_coarse_route();
+    test_dominance();
+    test_backtrack_flags();
+    test_contention();
+    test_repair();
+    test_parallel();
+    test_portfolio();
+    test_shadow();
+    test_precompute();
+    test_anytime();
+    test_horizon();
+    test_slices();
+    test_slots();
     printf("PASS\n");
     return 0;
 }
@@ -304,12 +1683,12 @@ int n_malloc = 0, n_free = 0;
 void *count_malloc(const char *msg, size_t s) {
     void *p = malloc(s);
     //fprintf(logff, "%p malloc %s\n", p, msg);
-    n_malloc++;
+    __sync_fetch_and_add(&n_malloc, 1);
     return p;
 }
 
 void count_free(const char *msg, void *p) {
     //fprintf(logff, "%p free %s\n", p, msg);
-    n_free++;
+    __sync_fetch_and_add(&n_free, 1);
     free(p);
 }
@@ -0,0 +1,184 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// Tuning the greedy search's weights:  A set of weights is scored by
+// playing each game of a corpus of seeds and boards for a fixed number of
+// frames, in child atc-ai's run as many at a time as asked, and adding up
+// the search steps, backtracks, and longest route each one logs.  Then
+// the weights are halved or doubled one at a time, keeping each change
+// which lowers the score, until a round goes by without one.
+
+#define MAX_GAMES 256
+#define BACKTRACK_WEIGHT 10
+#define LONGEST_WEIGHT 100
+#define FAILED_GAME_SCORE 1000000000LL
+#define MAX_ROUNDS 3
+
+struct game {
+    intmax_t seed;
+    char board[32];
+    pid_t pid;
+    char logname[64];
+};
+static struct game games[MAX_GAMES];
+static int n_games;
+
+// Read the corpus, one "<seed> <board>" to a line, skipping '#' comments.
+static void read_corpus(const char *corpus) {
+    FILE *f = fopen(corpus, "r");
+    if (f == NULL) {
+        errexit('U', "Can't open tuning corpus \"%s\": %s", corpus,
+                strerror(errno));
+    }
+    char line[128];
+    while (n_games < MAX_GAMES && fgets(line, sizeof line, f)) {
+        struct game *g = &games[n_games];
+        if (line[0] != '#' &&
+                sscanf(line, "%jd %31s", &g->seed, g->board) == 2)
+            n_games++;
+    }
+    fclose(f);
+    if (n_games == 0)
+        errexit('U', "No games in tuning corpus \"%s\".", corpus);
+}
+
+// Start game 'g' with the current weights.  Its stdin is 'in_fd', which
+// is never written, as atc-ai quits at the end of its input.
+static void start_game(struct game *g, const char *self, const char *atc_cmd,
+                       const char *weights, int frames, int in_fd) {
+    char seed[24], nframes[16];
+    snprintf(seed, sizeof seed, "%jd", g->seed);
+    snprintf(nframes, sizeof nframes, "%d", frames);
+    snprintf(g->logname, sizeof g->logname, "/tmp/atc-ai-tune.%d.%d.log",
+             (int) getpid(), (int) (g - games));
+
+    g->pid = fork();
+    if (g->pid < 0)
+        errexit(errno, "fork failed: %s", strerror(errno));
+    if (g->pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(in_fd, 0);
+        dup2(null, 1);
+        dup2(null, 2);
+        execl(self, self, "-q", "-d", "0", "-t", "0", "-r", seed,
+              "-g", g->board, "-f", nframes, "-H", weights, "-a", atc_cmd,
+              "-L", g->logname, (char *) NULL);
+        _exit(127);
+    }
+}
+
+// The score of game 'g', which exited with 'status', from its log.  One
+// which didn't last all 'frames' failed.
+static long long game_score(struct game *g, int status, int frames) {
+    long long score = FAILED_GAME_SCORE;
+    FILE *f = fopen(g->logname, "r");
+    if (f == NULL)
+        return score;
+    char line[256];
+    long routes, steps, backtracks;
+    int frame, longest;
+    while (fgets(line, sizeof line, f)) {
+        if (sscanf(line, "Planner totals at time %d: %ld routes, %ld steps, "
+                         "%ld backtracks, longest route %d moves.", &frame,
+                   &routes, &steps, &backtracks, &longest) == 5 &&
+                frame >= frames) {
+            score = steps + BACKTRACK_WEIGHT * backtracks +
+                    LONGEST_WEIGHT * longest;
+        }
+    }
+    fclose(f);
+    unlink(g->logname);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        score = FAILED_GAME_SCORE;
+    return score;
+}
+
+// Play the corpus with the current weights, and return its score.
+static long long score_weights(const char *self, const char *atc_cmd,
+                               int jobs, int frames, int in_fd) {
+    char weights[256];
+    format_heuristics(weights, sizeof weights);
+
+    long long total = 0;
+    int next = 0, running = 0, failed = 0;
+    while (next < n_games || running) {
+        while (running < jobs && next < n_games) {
+            start_game(&games[next++], self, atc_cmd, weights, frames,
+                       in_fd);
+            running++;
+        }
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            errexit(errno, "wait failed: %s", strerror(errno));
+        for (int i = 0; i < next; i++) {
+            if (games[i].pid != pid)
+                continue;
+            long long score = game_score(&games[i], status, frames);
+            if (score == FAILED_GAME_SCORE)
+                failed++;
+            total += score;
+            games[i].pid = 0;
+            running--;
+        }
+    }
+
+    fprintf(logff, "Weights %s:  score %lld, %d of %d games failed.\n",
+            weights, total, failed, n_games);
+    return total;
+}
+
+int tune(const char *corpus, const char *self, const char *atc_cmd,
+         int jobs, int frames) {
+    read_corpus(corpus);
+    if (jobs < 1)
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int in_pipe[2];
+    if (pipe(in_pipe))
+        errexit(errno, "pipe failed: %s", strerror(errno));
+
+    long long best = score_weights(self, atc_cmd, jobs, frames, in_pipe[0]);
+    if (best >= n_games * FAILED_GAME_SCORE)
+        errexit('U', "Every game in the tuning corpus failed; see the log.");
+    for (int round = 0; round < MAX_ROUNDS; round++) {
+        bool improved = false;
+        for (int i = 0; i < n_heur_params; i++) {
+            const struct heur_param *hp = &heur_params[i];
+            const int orig = *hp->value;
+            int keep = orig;
+            const int tries[2] = { orig / 2, orig ? orig * 2 : 1 };
+            for (int t = 0; t < 2; t++) {
+                if (tries[t] < hp->min || tries[t] == orig)
+                    continue;
+                *hp->value = tries[t];
+                long long score = score_weights(self, atc_cmd, jobs, frames,
+                                                in_pipe[0]);
+                if (score < best) {
+                    best = score;
+                    keep = tries[t];
+                    improved = true;
+                }
+            }
+            *hp->value = keep;
+        }
+        if (!improved)
+            break;
+    }
+
+    char weights[256];
+    format_heuristics(weights, sizeof weights);
+    printf("Best weights (score %lld):  -H %s\n", best, weights);
+    fprintf(logff, "Best weights (score %lld):  -H %s\n", best, weights);
+    return 0;
+}
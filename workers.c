@@ -0,0 +1,91 @@
+// Copyright 2013 Jacob L. Mandelson
+// This code may be distributed under the terms of the Affero General
+// Public License, ver. 3.  See the file "AGPLv3" for details.
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "atc-ai.h"
+#include "pathfind.h"
+
+// A pool of worker threads to run a batch of independent jobs, such as
+// planning the courses of the planes which appear in the same tick.  The
+// calling thread works on the batch too, and run_jobs() returns once the
+// whole batch is done.  Jobs mustn't write to anything the others read:
+// for course planning that means the reservation table is left alone until
+// the batch is done.  A job which runs a batch of its own (a portfolio
+// race, planning one of a tick's new planes) runs it itself, in turn.
+
+int n_workers = 1;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cv = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cv = PTHREAD_COND_INITIALIZER;
+
+static void (*job_fn)(void *arg, int i);
+static void *job_arg;
+static int n_jobs, next_job, n_done;
+static unsigned int batch_no;
+static __thread bool in_job;
+
+// Run jobs from the current batch until there are none left to start.
+// Called with 'lock' held.
+static void work() {
+    while (next_job < n_jobs) {
+        int i = next_job++;
+        pthread_mutex_unlock(&lock);
+        in_job = true;
+        job_fn(job_arg, i);
+        in_job = false;
+        pthread_mutex_lock(&lock);
+        if (++n_done == n_jobs)
+            pthread_cond_signal(&done_cv);
+    }
+}
+
+static void *worker(void *unused) {
+    (void) unused;
+    unsigned int seen = 0;
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (batch_no == seen)
+            pthread_cond_wait(&work_cv, &lock);
+        seen = batch_no;
+        work();
+    }
+    return NULL;
+}
+
+// Start up the pool, with 'n' threads in all counting the caller's.
+void workers_init(int n) {
+    static bool started = false;
+    if (started || n <= 1)
+        return;
+    started = true;
+    n_workers = n;
+    for (int i = 1; i < n; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, NULL))
+            errexit('w', "Unable to start worker thread #%d.", i);
+        pthread_detach(thread);
+    }
+}
+
+void run_jobs(void (*fn)(void *arg, int i), void *arg, int n) {
+    if (n_workers <= 1 || n <= 1 || in_job) {
+        for (int i = 0; i < n; i++)
+            fn(arg, i);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    job_fn = fn;
+    job_arg = arg;
+    n_jobs = n;
+    next_job = n_done = 0;
+    batch_no++;
+    pthread_cond_broadcast(&work_cv);
+    work();
+    while (n_done < n_jobs)
+        pthread_cond_wait(&done_cv, &lock);
+    pthread_mutex_unlock(&lock);
+}